@@ -0,0 +1,852 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <numeric>
+#include <fstream>
+#include <atomic>
+#include <new>
+#include <sys/resource.h>
+
+#include "jagged_array.h"
+#include "concurrent_jagged_array.h"
+
+//
+// Timing runs for JaggedArray. Build with "make benchmark".
+//
+
+// every allocation of the program is counted, for the allocation stats of replay.
+// All the replaceable forms of new and delete are replaced, so each pair matches.
+// They are kept out of line: inlined, g++ pairs a new with the free() inside delete
+// and warns of a mismatch.
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+std::atomic<unsigned long long> allocation_count(0);
+std::atomic<unsigned long long> allocation_bytes(0);
+
+static void* counted_malloc(size_t n) noexcept {
+    allocation_count++;
+    allocation_bytes += n;
+    return malloc(n > 0 ? n : 1);
+}
+
+NOINLINE void* operator new(size_t n) {
+    void* p = counted_malloc(n);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+NOINLINE void* operator new[](size_t n) {
+    return operator new(n);
+}
+
+NOINLINE void* operator new(size_t n, const std::nothrow_t&) noexcept {
+    return counted_malloc(n);
+}
+
+NOINLINE void* operator new[](size_t n, const std::nothrow_t&) noexcept {
+    return counted_malloc(n);
+}
+
+NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete(void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+void PackBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads);
+void StorageBenchmark(size_type num_elements, size_type num_bins);
+void IterateBenchmark(size_type num_elements, size_type num_bins);
+void BuildBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads);
+void OffsetsBenchmark(size_type num_elements, size_type num_bins);
+void ReplayBenchmark(const char* filename, int iterations);
+void GenerateOps(const char* filename, unsigned int num_ops, size_type num_bins, unsigned int seed);
+void RemoveBenchmark(size_type num_elements, size_type num_bins);
+void ConcurrentBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads);
+void SortedBenchmark(size_type num_bins, size_type bin_size);
+
+void Usage(const char* program) {
+    std::cerr << "Usage: " << program << " pack [num_elements] [num_bins] [max_threads]" << std::endl;
+    std::cerr << "       " << program << " storage [num_elements] [num_bins]" << std::endl;
+    std::cerr << "       " << program << " iterate [num_elements] [num_bins]" << std::endl;
+    std::cerr << "       " << program << " build [num_elements] [num_bins] [max_threads]" << std::endl;
+    std::cerr << "       " << program << " offsets [num_elements] [num_bins]" << std::endl;
+    std::cerr << "       " << program << " replay <op_file> [iterations]" << std::endl;
+    std::cerr << "       " << program << " generate <op_file> [num_ops] [num_bins] [seed]" << std::endl;
+    std::cerr << "       " << program << " remove [num_elements] [num_bins]" << std::endl;
+    std::cerr << "       " << program << " concurrent [num_elements] [num_bins] [max_threads]" << std::endl;
+    std::cerr << "       " << program << " sorted [num_bins] [bin_size]" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2)
+        Usage(argv[0]);
+    std::string mode = argv[1];
+    if (mode == "pack") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000000;
+        unsigned int max_threads = argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+        if (num_bins == 0 || max_threads == 0)
+            Usage(argv[0]);
+        PackBenchmark(num_elements, num_bins, max_threads);
+    } else if (mode == "storage") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000000;
+        if (num_bins == 0)
+            Usage(argv[0]);
+        StorageBenchmark(num_elements, num_bins);
+    } else if (mode == "iterate") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000000;
+        if (num_bins == 0)
+            Usage(argv[0]);
+        IterateBenchmark(num_elements, num_bins);
+    } else if (mode == "build") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000000;
+        unsigned int max_threads = argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+        if (num_bins == 0 || max_threads == 0)
+            Usage(argv[0]);
+        BuildBenchmark(num_elements, num_bins, max_threads);
+    } else if (mode == "offsets") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 5000000;
+        if (num_bins == 0)
+            Usage(argv[0]);
+        OffsetsBenchmark(num_elements, num_bins);
+    } else if (mode == "replay") {
+        if (argc < 3)
+            Usage(argv[0]);
+        int iterations = argc > 3 ? atoi(argv[3]) : 10;
+        if (iterations <= 0)
+            Usage(argv[0]);
+        ReplayBenchmark(argv[2], iterations);
+    } else if (mode == "generate") {
+        if (argc < 3)
+            Usage(argv[0]);
+        unsigned int num_ops = argc > 3 ? atoi(argv[3]) : 1000000;
+        size_type num_bins = argc > 4 ? atoi(argv[4]) : 1000;
+        unsigned int seed = argc > 5 ? atoi(argv[5]) : 1;
+        if (num_bins == 0)
+            Usage(argv[0]);
+        GenerateOps(argv[2], num_ops, num_bins, seed);
+    } else if (mode == "remove") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 2000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000;
+        if (num_bins == 0)
+            Usage(argv[0]);
+        RemoveBenchmark(num_elements, num_bins);
+    } else if (mode == "concurrent") {
+        size_type num_elements = argc > 2 ? atoi(argv[2]) : 10000000;
+        size_type num_bins = argc > 3 ? atoi(argv[3]) : 1000000;
+        unsigned int max_threads = argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+        if (num_bins == 0 || max_threads == 0)
+            Usage(argv[0]);
+        ConcurrentBenchmark(num_elements, num_bins, max_threads);
+    } else if (mode == "sorted") {
+        size_type num_bins = argc > 2 ? atoi(argv[2]) : 10000;
+        size_type bin_size = argc > 3 ? atoi(argv[3]) : 1000;
+        if (num_bins < 2)
+            Usage(argv[0]);
+        SortedBenchmark(num_bins, bin_size);
+    } else {
+        Usage(argv[0]);
+    }
+}
+
+// milliseconds since start
+double ElapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a small, fast pseudo random generator so the data set is the same on every run
+unsigned int NextRandom(unsigned long long& state) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int)(state >> 33);
+}
+
+// Time pack()/unpack() of num_elements ints spread unevenly over num_bins bins,
+// serially and with 2, 4, ... up to max_threads threads. Each time is the best of 3.
+void PackBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads) {
+    JaggedArray<int> ja(num_bins);
+    unsigned long long state = 1;
+    long long checksum = 0;
+    for (size_type i = 0; i < num_elements; i++) {
+        // squaring skews the bin sizes, so some ranges of bins hold more than others
+        unsigned long long r = NextRandom(state) % num_bins;
+        size_type bin = (size_type)(r * r / num_bins);
+        ja.addElement(bin, (int)i);
+        checksum += bin * (long long)i;
+    }
+    ja.shrink_to_fit();
+    std::cout << "pack/unpack of " << num_elements << " ints in " << num_bins << " bins" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "pack ms" << std::setw(12) << "unpack ms"
+              << std::setw(10) << "speedup" << std::endl;
+
+    double serial_total = 0;
+    for (unsigned int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        double best_pack = 0, best_unpack = 0;
+        for (int trial = 0; trial < 3; trial++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ja.pack(threads);
+            double pack_ms = ElapsedMs(start);
+            start = std::chrono::steady_clock::now();
+            ja.unpack(threads);
+            double unpack_ms = ElapsedMs(start);
+            if (trial == 0 || pack_ms < best_pack) best_pack = pack_ms;
+            if (trial == 0 || unpack_ms < best_unpack) best_unpack = unpack_ms;
+        }
+        if (threads == 1)
+            serial_total = best_pack + best_unpack;
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(12) << best_pack << std::setw(12) << best_unpack
+                  << std::setw(9) << std::setprecision(2) << serial_total / (best_pack + best_unpack)
+                  << "x" << std::endl;
+        if (threads == max_threads)
+            break;
+    }
+
+    // the contents must have survived all the round trips
+    long long check = 0;
+    for (size_type b = 0; b < ja.numBins(); b++)
+        for (size_type i = 0; i < ja.numElementsInBin(b); i++)
+            check += b * (long long)ja.getElement(b, i);
+    if (check != checksum) {
+        std::cerr << "ERROR: contents changed by pack/unpack" << std::endl;
+        exit(1);
+    }
+}
+
+// fill ja with num_elements ints spread unevenly over its bins, as in PackBenchmark
+template <class JA>
+void Fill(JA& ja, size_type num_elements) {
+    unsigned long long state = 1;
+    size_type num_bins = ja.numBins();
+    for (size_type i = 0; i < num_elements; i++) {
+        unsigned long long r = NextRandom(state) % num_bins;
+        ja.addElement((size_type)(r * r / num_bins), (int)i);
+    }
+}
+
+// Time building, clearing, refilling, packing and destroying one JaggedArray<int>
+// with bins from Storage. Each time is the best of 3.
+template <class Storage>
+void StorageRow(const char* name, size_type num_elements, size_type num_bins) {
+    const int NUM_PHASES = 5;
+    double best[NUM_PHASES];
+    for (int trial = 0; trial < 3; trial++) {
+        double ms[NUM_PHASES];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        JaggedArray<int, Storage>* ja = new JaggedArray<int, Storage>(num_bins);
+        Fill(*ja, num_elements);
+        ms[0] = ElapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        ja->clear();
+        ms[1] = ElapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        Fill(*ja, num_elements);
+        ms[2] = ElapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        ja->pack();
+        ja->unpack();
+        ms[3] = ElapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        delete ja;
+        ms[4] = ElapsedMs(start);
+        for (int p = 0; p < NUM_PHASES; p++)
+            if (trial == 0 || ms[p] < best[p])
+                best[p] = ms[p];
+    }
+    std::cout << std::setw(8) << name << std::fixed << std::setprecision(1);
+    for (int p = 0; p < NUM_PHASES; p++)
+        std::cout << std::setw(12) << best[p];
+    std::cout << std::endl;
+}
+
+// Compare the storage policies for the arrays of unpacked bins
+void StorageBenchmark(size_type num_elements, size_type num_bins) {
+    std::cout << "storage of " << num_elements << " ints in " << num_bins << " bins, times in ms" << std::endl;
+    std::cout << std::setw(8) << "storage" << std::setw(12) << "build" << std::setw(12) << "clear"
+              << std::setw(12) << "refill" << std::setw(12) << "pack+unpack" << std::setw(12) << "destroy"
+              << std::endl;
+    StorageRow<HeapStorage<int> >("heap", num_elements, num_bins);
+    StorageRow<ArenaStorage<int> >("arena", num_elements, num_bins);
+}
+
+// the best of 10 times of sum(ja), which must come to expected
+template <class F>
+double BestSumMs(F sum, long long expected) {
+    double best = 0;
+    for (int trial = 0; trial < 10; trial++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long long s = sum();
+        double ms = ElapsedMs(start);
+        if (s != expected) {
+            std::cerr << "ERROR: wrong sum " << s << " instead of " << expected << std::endl;
+            exit(1);
+        }
+        if (trial == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+// Time summing all elements through getElement(), bin() and the flat iterator,
+// unpacked and packed
+void IterateBenchmark(size_type num_elements, size_type num_bins) {
+    JaggedArray<int> ja(num_bins);
+    Fill(ja, num_elements);
+    long long expected = (long long)num_elements * (num_elements - 1) / 2;
+    std::cout << "sum of " << num_elements << " ints in " << num_bins << " bins, times in ms" << std::endl;
+    std::cout << std::setw(10) << "mode" << std::setw(12) << "getElement" << std::setw(12) << "bin()"
+              << std::setw(12) << "iterator" << std::setw(12) << "data()" << std::endl;
+    for (int packed = 0; packed < 2; packed++) {
+        if (packed)
+            ja.pack();
+        double by_element = BestSumMs([&]() {
+            long long s = 0;
+            for (size_type b = 0; b < ja.numBins(); b++)
+                for (size_type i = 0; i < ja.numElementsInBin(b); i++)
+                    s += ja.getElement(b, i);
+            return s;
+        }, expected);
+        double by_bin = BestSumMs([&]() {
+            long long s = 0;
+            for (size_type b = 0; b < ja.numBins(); b++) {
+                JaggedBin<int> bin = ja.bin(b);
+                s = std::accumulate(bin.begin(), bin.end(), s);
+            }
+            return s;
+        }, expected);
+        double by_iterator = BestSumMs([&]() {
+            return std::accumulate(ja.begin(), ja.end(), 0LL);
+        }, expected);
+        std::cout << std::setw(10) << (packed ? "packed" : "unpacked") << std::fixed << std::setprecision(1)
+                  << std::setw(12) << by_element << std::setw(12) << by_bin << std::setw(12) << by_iterator;
+        if (packed) {
+            double by_data = BestSumMs([&]() {
+                return std::accumulate(ja.data(), ja.data() + ja.numElements(), 0LL);
+            }, expected);
+            std::cout << std::setw(12) << by_data;
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Time building a packed JaggedArray<int> from a list of (bin, value) pairs with
+// addElement() and pack(), and with fromPairs() on 1, 2, 4 ... max_threads threads.
+// Each time is the best of 3.
+void BuildBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads) {
+    std::vector<std::pair<size_type, int> > pairs;
+    pairs.reserve(num_elements);
+    unsigned long long state = 1;
+    for (size_type i = 0; i < num_elements; i++) {
+        unsigned long long r = NextRandom(state) % num_bins;
+        pairs.push_back(std::make_pair((size_type)(r * r / num_bins), (int)i));
+    }
+    std::cout << "packed build of " << num_elements << " ints in " << num_bins << " bins" << std::endl;
+    std::cout << std::setw(20) << "method" << std::setw(12) << "ms" << std::endl;
+
+    double best = 0;
+    long long checksum = 0;
+    for (int trial = 0; trial < 3; trial++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        JaggedArray<int> ja(num_bins);
+        for (size_type i = 0; i < num_elements; i++)
+            ja.addElement(pairs[i].first, pairs[i].second);
+        ja.pack();
+        double ms = ElapsedMs(start);
+        if (trial == 0 || ms < best) best = ms;
+        checksum = 0;
+        for (size_type i = 0; i < num_elements; i++)
+            checksum += (long long)i * ja.data()[i];
+    }
+    std::cout << std::setw(20) << "addElement+pack" << std::fixed << std::setprecision(1)
+              << std::setw(12) << best << std::endl;
+
+    for (unsigned int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        for (int trial = 0; trial < 3; trial++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            JaggedArray<int> ja = JaggedArray<int>::fromPairs(pairs.begin(), pairs.end(), num_bins, threads);
+            double ms = ElapsedMs(start);
+            if (trial == 0 || ms < best) best = ms;
+            long long check = 0;
+            for (size_type i = 0; i < num_elements; i++)
+                check += (long long)i * ja.data()[i];
+            if (check != checksum) {
+                std::cerr << "ERROR: fromPairs built something else than addElement" << std::endl;
+                exit(1);
+            }
+        }
+        std::string method = "fromPairs, " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+        std::cout << std::setw(20) << method << std::setw(12) << best << std::endl;
+        if (threads == max_threads)
+            break;
+    }
+}
+
+// Memory of the offsets of a packed JaggedArray<int> built from pairs with Offsets,
+// and the time to look up the size of every bin and a million random elements
+template <class Offsets>
+void OffsetsRow(const char* name, const std::vector<std::pair<size_type, int> >& pairs, size_type num_bins) {
+    typedef JaggedArray<int, HeapStorage<int>, Offsets> JA;
+    JA ja = JA::fromPairs(pairs.begin(), pairs.end(), num_bins);
+    double best_sizes = 0, best_random = 0;
+    long long check = 0;
+    for (int trial = 0; trial < 3; trial++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long long total = 0;
+        for (size_type b = 0; b < num_bins; b++)
+            total += ja.numElementsInBin(b);
+        double ms = ElapsedMs(start);
+        if ((unsigned long long)total != ja.numElements()) {
+            std::cerr << "ERROR: " << name << " bin sizes do not add up" << std::endl;
+            exit(1);
+        }
+        if (trial == 0 || ms < best_sizes) best_sizes = ms;
+        unsigned long long state = 7;
+        start = std::chrono::steady_clock::now();
+        check = 0;
+        for (int i = 0; i < 1000000; i++) {
+            size_type b = NextRandom(state) % num_bins;
+            if (ja.numElementsInBin(b) > 0)
+                check += ja.getElement(b, 0);
+        }
+        ms = ElapsedMs(start);
+        if (trial == 0 || ms < best_random) best_random = ms;
+    }
+    std::cout << std::setw(10) << name << std::fixed << std::setprecision(2)
+              << std::setw(14) << ja.offsetBytes() / (1024.0 * 1024.0)
+              << std::setw(14) << ja.offsetBytes() / (double)num_bins
+              << std::setprecision(1) << std::setw(12) << best_sizes << std::setw(12) << best_random
+              << "  (" << check << ")" << std::endl;
+}
+
+// Compare the encodings of the packed offsets
+void OffsetsBenchmark(size_type num_elements, size_type num_bins) {
+    std::vector<std::pair<size_type, int> > pairs;
+    pairs.reserve(num_elements);
+    unsigned long long state = 1;
+    for (size_type i = 0; i < num_elements; i++)
+        pairs.push_back(std::make_pair(NextRandom(state) % num_bins, (int)i));
+    std::cout << "offsets of " << num_elements << " ints in " << num_bins << " bins" << std::endl;
+    std::cout << std::setw(10) << "offsets" << std::setw(14) << "MB" << std::setw(14) << "bytes/bin"
+              << std::setw(12) << "sizes ms" << std::setw(12) << "random ms" << std::endl;
+    OffsetsRow<Offsets32>("32 bit", pairs, num_bins);
+    OffsetsRow<Offsets64>("64 bit", pairs, num_bins);
+    OffsetsRow<CompactOffsets>("compact", pairs, num_bins);
+}
+
+// one command of an op file, in the format of BatchTest in main.cpp
+struct Op {
+    enum Kind { ADD, GET, REMOVE, PACK, UNPACK, CLEAR, NUM_KINDS };
+    Kind kind;
+    size_type bin;
+    size_type i;
+    char value;     // added, or expected by GET and REMOVE
+};
+const char* OP_NAMES[Op::NUM_KINDS] = { "addElement", "getElement", "removeElement", "pack", "unpack", "clear" };
+
+// Counts of latencies in power-of-two buckets: bucket k holds [2^k, 2^(k+1)) ns
+struct Histogram {
+    static const int NUM_BUCKETS = 48;
+    unsigned long long buckets[NUM_BUCKETS];
+    unsigned long long count;
+    double total_ns;
+    double max_ns;
+    Histogram() : count(0), total_ns(0), max_ns(0) {
+        for (int k = 0; k < NUM_BUCKETS; k++)
+            buckets[k] = 0;
+    }
+    void add(double ns) {
+        int k = 0;
+        while (k + 1 < NUM_BUCKETS && ns >= (double)(1ULL << (k + 1)))
+            k++;
+        buckets[k]++;
+        count++;
+        total_ns += ns;
+        if (ns > max_ns)
+            max_ns = ns;
+    }
+    // the upper end of the bucket that holds fraction q of the latencies
+    double percentile(double q) const {
+        unsigned long long seen = 0;
+        for (int k = 0; k < NUM_BUCKETS; k++) {
+            seen += buckets[k];
+            if (seen >= q * count)
+                return std::min((double)(1ULL << (k + 1)), max_ns);
+        }
+        return max_ns;
+    }
+};
+
+// peak resident set size of the process so far, in MB
+double PeakRssMb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;    // ru_maxrss is in KB on Linux
+}
+
+// parse an op file into num_bins and ops. The bin sizes are followed as the ops are
+// read, so an op on an element that won't be there is rejected up front.
+void ReadOps(const char* filename, size_type& num_bins, std::vector<Op>& ops) {
+    std::ifstream istr(filename);
+    if (!istr) {
+        std::cerr << "ERROR: cannot open file " << filename << std::endl;
+        exit(1);
+    }
+    std::string token;
+    if (!(istr >> token >> num_bins) || token != "create") {
+        std::cerr << "ERROR: " << filename << " does not start with create" << std::endl;
+        exit(1);
+    }
+    std::vector<size_type> sizes(num_bins, 0);
+    while (istr >> token) {
+        Op op;
+        op.bin = op.i = 0;
+        op.value = 0;
+        if (token == "addElement") {
+            op.kind = Op::ADD;
+            istr >> op.bin >> op.value;
+        } else if (token == "getElement") {
+            op.kind = Op::GET;
+            istr >> op.bin >> op.i >> op.value;
+        } else if (token == "removeElement") {
+            op.kind = Op::REMOVE;
+            istr >> op.bin >> op.i >> op.value;
+        } else if (token == "pack") {
+            op.kind = Op::PACK;
+        } else if (token == "unpack") {
+            op.kind = Op::UNPACK;
+        } else if (token == "clear") {
+            op.kind = Op::CLEAR;
+        } else {
+            std::cerr << "ERROR: unknown token " << token << std::endl;
+            exit(1);
+        }
+        if (!istr || op.bin >= num_bins
+            || ((op.kind == Op::GET || op.kind == Op::REMOVE) && op.i >= sizes[op.bin])) {
+            std::cerr << "ERROR: bad " << token << " in " << filename << std::endl;
+            exit(1);
+        }
+        if (op.kind == Op::ADD)
+            sizes[op.bin]++;
+        else if (op.kind == Op::REMOVE)
+            sizes[op.bin]--;
+        else if (op.kind == Op::CLEAR)
+            std::fill(sizes.begin(), sizes.end(), 0);
+        ops.push_back(op);
+    }
+}
+
+// Replay the ops of an op file on a JaggedArray<char> iterations times, timing
+// each op. The file is parsed once up front, so only JaggedArray is measured.
+void ReplayBenchmark(const char* filename, int iterations) {
+    size_type num_bins;
+    std::vector<Op> ops;
+    ReadOps(filename, num_bins, ops);
+    std::cout << "replay of " << ops.size() << " ops on " << num_bins << " bins, "
+              << iterations << " times" << std::endl;
+
+    Histogram histograms[Op::NUM_KINDS];
+    double best_ms = 0, total_ms = 0;
+    unsigned long long start_count = allocation_count, start_bytes = allocation_bytes;
+    for (int iter = 0; iter < iterations; iter++) {
+        std::chrono::steady_clock::time_point replay_start = std::chrono::steady_clock::now();
+        JaggedArray<char>* ja = new JaggedArray<char>(num_bins);
+        for (size_t k = 0; k < ops.size(); k++) {
+            const Op& op = ops[k];
+            bool ok = true;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            switch (op.kind) {
+            case Op::ADD:    ja->addElement(op.bin, op.value); break;
+            case Op::GET:    ok = ja->getElement(op.bin, op.i) == op.value; break;
+            case Op::REMOVE: ok = ja->getElement(op.bin, op.i) == op.value;
+                             ja->removeElement(op.bin, op.i); break;
+            case Op::PACK:   ja->pack(); break;
+            case Op::UNPACK: ja->unpack(); break;
+            case Op::CLEAR:  ja->clear(); break;
+            default: break;
+            }
+            histograms[op.kind].add(std::chrono::duration<double, std::nano>(
+                                        std::chrono::steady_clock::now() - start).count());
+            if (!ok) {
+                std::cerr << "ERROR: op " << k << " (" << OP_NAMES[op.kind] << ") found the wrong element" << std::endl;
+                exit(1);
+            }
+        }
+        delete ja;
+        double ms = ElapsedMs(replay_start);
+        total_ms += ms;
+        if (iter == 0 || ms < best_ms)
+            best_ms = ms;
+    }
+    unsigned long long allocations = allocation_count - start_count;
+    unsigned long long bytes = allocation_bytes - start_bytes;
+
+    std::cout << std::setw(14) << "op" << std::setw(10) << "count" << std::setw(10) << "mean ns"
+              << std::setw(10) << "p50 <=" << std::setw(10) << "p90 <=" << std::setw(10) << "p99 <="
+              << std::setw(12) << "max ns" << std::endl;
+    for (int kind = 0; kind < Op::NUM_KINDS; kind++) {
+        const Histogram& h = histograms[kind];
+        if (h.count == 0)
+            continue;
+        std::cout << std::setw(14) << OP_NAMES[kind] << std::setw(10) << h.count / iterations
+                  << std::fixed << std::setprecision(0) << std::setw(10) << h.total_ns / h.count
+                  << std::setw(10) << h.percentile(0.5) << std::setw(10) << h.percentile(0.9)
+                  << std::setw(10) << h.percentile(0.99) << std::setw(12) << h.max_ns << std::endl;
+    }
+    std::cout << std::fixed << std::setprecision(2)
+              << "replay ms: best " << best_ms << ", mean " << total_ms / iterations
+              << " (times include reading the clock around every op)" << std::endl;
+    std::cout << "allocations per replay: " << allocations / iterations
+              << ", bytes " << bytes / iterations << std::endl;
+    std::cout << "peak RSS: " << PeakRssMb() << " MB" << std::endl;
+}
+
+// Write an op file of num_ops random ops on num_bins bins that BatchTest and
+// replay can run: about half addElement, a third getElement, the rest
+// removeElement with an occasional pack, unpack or clear. The expected values
+// come from a plain model of the JaggedArray.
+void GenerateOps(const char* filename, unsigned int num_ops, size_type num_bins, unsigned int seed) {
+    std::ofstream ostr(filename);
+    if (!ostr) {
+        std::cerr << "ERROR: cannot open file " << filename << " for writing" << std::endl;
+        exit(1);
+    }
+    unsigned long long state = seed;
+    std::vector<std::string> model(num_bins);
+    bool packed = false;
+    ostr << "create " << num_bins << "\n";
+    for (unsigned int k = 0; k < num_ops; k++) {
+        unsigned int r = NextRandom(state) % 1000;
+        size_type bin = NextRandom(state) % num_bins;
+        std::string& elements = model[bin];
+        if (r < 5) {
+            ostr << (packed ? "unpack" : "pack") << "\n";
+            packed = !packed;
+        } else if (r < 6 && !packed) {
+            ostr << "clear\n";
+            for (size_type b = 0; b < num_bins; b++)
+                model[b].clear();
+        } else if (r < 500 || elements.empty()) {
+            char value = 'a' + NextRandom(state) % 26;
+            ostr << "addElement " << bin << " " << value << "\n";
+            elements.push_back(value);
+        } else if (r < 850) {
+            size_type i = NextRandom(state) % elements.size();
+            ostr << "getElement " << bin << " " << i << " " << elements[i] << "\n";
+        } else {
+            size_type i = NextRandom(state) % elements.size();
+            ostr << "removeElement " << bin << " " << i << " " << elements[i] << "\n";
+            elements.erase(i, 1);
+        }
+    }
+    if (!ostr) {
+        std::cerr << "ERROR: failed writing file " << filename << std::endl;
+        exit(1);
+    }
+}
+
+// Time removing the first half of every bin of an unpacked JaggedArray<int>, front
+// element first, with removeElement(), swapRemove(), and markRemoved() followed by
+// one pack(). Each time is the best of 3.
+void RemoveBenchmark(size_type num_elements, size_type num_bins) {
+    const int NUM_WAYS = 3;
+    const char* names[NUM_WAYS] = { "removeElement", "swapRemove", "markRemoved+pack" };
+    double best[NUM_WAYS];
+    for (int trial = 0; trial < 3; trial++) {
+        for (int way = 0; way < NUM_WAYS; way++) {
+            JaggedArray<int> ja(num_bins);
+            Fill(ja, num_elements);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (size_type b = 0; b < num_bins; b++) {
+                size_type n = ja.numElementsInBin(b) / 2;
+                for (size_type i = 0; i < n; i++) {
+                    if (way == 0)
+                        ja.removeElement(b, 0);
+                    else if (way == 1)
+                        ja.swapRemove(b, 0);
+                    else
+                        ja.markRemoved(b, i);
+                }
+            }
+            if (way == 2)
+                ja.pack();
+            double ms = ElapsedMs(start);
+            if (trial == 0 || ms < best[way])
+                best[way] = ms;
+        }
+    }
+    std::cout << "removing half of " << num_elements << " ints in " << num_bins << " bins, times in ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (int way = 0; way < NUM_WAYS; way++)
+        std::cout << std::setw(18) << names[way] << std::setw(12) << best[way] << std::endl;
+}
+
+// Time filling a ConcurrentJaggedArray<int> from 1, 2, 4 ... max_threads threads, each
+// adding its share of a list of (bin, value) pairs, and then freeze() on as many
+// threads. One lock for all bins shows what the striping saves. Each time is the
+// best of 3; the first row is a plain JaggedArray filled by one thread and packed.
+void ConcurrentBenchmark(size_type num_elements, size_type num_bins, unsigned int max_threads) {
+    std::vector<std::pair<size_type, int> > pairs;
+    pairs.reserve(num_elements);
+    unsigned long long state = 1;
+    for (size_type i = 0; i < num_elements; i++) {
+        unsigned long long r = NextRandom(state) % num_bins;
+        pairs.push_back(std::make_pair((size_type)(r * r / num_bins), (int)i));
+    }
+    std::cout << "concurrent fill of " << num_elements << " ints in " << num_bins << " bins, times in ms"
+              << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(10) << "stripes" << std::setw(12) << "fill"
+              << std::setw(12) << "freeze" << std::setw(10) << "speedup" << std::endl;
+
+    double serial_total = 0;
+    for (int trial = 0; trial < 3; trial++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        JaggedArray<int> ja(num_bins);
+        for (size_type i = 0; i < num_elements; i++)
+            ja.addElement(pairs[i].first, pairs[i].second);
+        ja.pack();
+        double ms = ElapsedMs(start);
+        if (trial == 0 || ms < serial_total) serial_total = ms;
+    }
+    std::cout << std::setw(8) << "plain" << std::setw(10) << "-" << std::fixed << std::setprecision(1)
+              << std::setw(12) << serial_total << std::setw(12) << "-" << std::setw(9)
+              << std::setprecision(2) << 1.0 << "x" << std::endl;
+
+    for (unsigned int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        for (int striped = 0; striped < 2; striped++) {
+            unsigned int num_stripes = striped ? std::min(1024u, num_bins) : 1;
+            double best_fill = 0, best_freeze = 0;
+            for (int trial = 0; trial < 3; trial++) {
+                ConcurrentJaggedArray<int> c(num_bins, num_stripes);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::vector<std::thread> producers;
+                for (unsigned int t = 0; t < threads; t++)
+                    producers.push_back(std::thread([&c, &pairs, threads, t]() {
+                        size_t end = range_begin(pairs.size(), threads, t + 1);
+                        for (size_t i = range_begin(pairs.size(), threads, t); i < end; i++)
+                            c.addElement(pairs[i].first, pairs[i].second);
+                    }));
+                for (unsigned int t = 0; t < threads; t++)
+                    producers[t].join();
+                double fill_ms = ElapsedMs(start);
+                start = std::chrono::steady_clock::now();
+                JaggedArray<int> ja = c.freeze(threads);
+                double freeze_ms = ElapsedMs(start);
+                if (ja.numElements() != num_elements) {
+                    std::cerr << "ERROR: freeze() lost elements" << std::endl;
+                    exit(1);
+                }
+                if (trial == 0 || fill_ms < best_fill) best_fill = fill_ms;
+                if (trial == 0 || freeze_ms < best_freeze) best_freeze = freeze_ms;
+            }
+            std::cout << std::setw(8) << threads << std::setw(10) << num_stripes
+                      << std::fixed << std::setprecision(1) << std::setw(12) << best_fill
+                      << std::setw(12) << best_freeze << std::setw(9) << std::setprecision(2)
+                      << serial_total / (best_fill + best_freeze) << "x" << std::endl;
+        }
+        if (threads == max_threads)
+            break;
+    }
+}
+
+// counts the values written to it, so the set operations are timed without storing
+struct CountingOutput {
+    long long* n;
+    CountingOutput& operator*() { return *this; }
+    CountingOutput& operator=(int) { ++*n; return *this; }
+    CountingOutput& operator++(int) { return *this; }
+};
+
+// Time the queries of a sorted JaggedArray<int> of num_bins bins of bin_size values
+// each, like adjacency lists: membership tests by scanning a bin and with contains(),
+// and intersecting and merging neighbouring bins with and without SSE2. Each time is
+// the best of 3.
+void SortedBenchmark(size_type num_bins, size_type bin_size) {
+    JaggedArray<int> ja(num_bins);
+    unsigned long long state = 1;
+    int range = (int)std::min(4ULL * bin_size + 1, 0x7fffffffULL);
+    for (size_type b = 0; b < num_bins; b++)
+        for (size_type i = 0; i < bin_size; i++)
+            ja.addElement(b, (int)(NextRandom(state) % range));
+    ja.packSorted();
+    const size_type NUM_QUERIES = 1000000;
+    std::vector<std::pair<size_type, int> > queries;
+    for (size_type q = 0; q < NUM_QUERIES; q++)
+        queries.push_back(std::make_pair(NextRandom(state) % num_bins, (int)(NextRandom(state) % range)));
+    std::cout << "sorted queries on " << num_bins << " bins of " << bin_size << " ints, times in ms"
+              << std::endl;
+
+    const int NUM_WAYS = 5;
+    const char* names[NUM_WAYS] = { "scan x1M", "contains x1M", "intersect scalar", "intersectBins",
+                                    "unionBins" };
+    double best[NUM_WAYS];
+    long long results[NUM_WAYS];
+    for (int trial = 0; trial < 3; trial++) {
+        for (int way = 0; way < NUM_WAYS; way++) {
+            long long n = 0;
+            CountingOutput out = { &n };
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (way < 2) {
+                for (size_type q = 0; q < NUM_QUERIES; q++) {
+                    JaggedBin<int> bin = ja.bin(queries[q].first);
+                    if (way == 0)
+                        n += std::find(bin.begin(), bin.end(), queries[q].second) != bin.end();
+                    else
+                        n += ja.contains(queries[q].first, queries[q].second);
+                }
+            }
+            for (size_type b = 0; way >= 2 && b + 1 < num_bins; b++) {
+                JaggedBin<int> x = ja.bin(b), y = ja.bin(b + 1);
+                if (way == 2)
+                    intersect_sorted_scalar(x.data(), x.size(), y.data(), y.size(), out);
+                else if (way == 3)
+                    ja.intersectBins(b, b + 1, out);
+                else
+                    ja.unionBins(b, b + 1, out);
+            }
+            double ms = ElapsedMs(start);
+            if (trial == 0 || ms < best[way])
+                best[way] = ms;
+            results[way] = n;
+        }
+    }
+    if (results[0] != results[1] || results[2] != results[3]) {
+        std::cerr << "ERROR: the sorted queries disagree" << std::endl;
+        exit(1);
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    for (int way = 0; way < NUM_WAYS; way++)
+        std::cout << std::setw(18) << names[way] << std::setw(12) << best[way]
+                  << "  (" << results[way] << ")" << std::endl;
+}
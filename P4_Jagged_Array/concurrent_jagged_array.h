@@ -0,0 +1,106 @@
+//
+//  concurrent_jagged_array.h
+//
+//  A JaggedArray that many threads can fill at once. Each bin is guarded by one of
+//  num_stripes locks, bin b by lock b % num_stripes, so threads adding to different
+//  bins rarely wait for each other and threads adding to the same bin take turns.
+//  Once the producers are done, freeze() packs what they added into a JaggedArray
+//  for reading.
+//
+
+#ifndef concurrent_jagged_array_h
+#define concurrent_jagged_array_h
+
+#include <mutex>
+
+#include "jagged_array.h"
+
+// Storage must allow allocate/deallocate on several threads at once, see storage.h
+template <class T, class Storage = HeapStorage<T>, class Offsets = Offsets32>
+class ConcurrentJaggedArray {
+public:
+    typedef JaggedArray<T, Storage, Offsets> Array;
+    static_assert(Storage::concurrent, "ConcurrentJaggedArray needs a concurrent Storage");
+
+    // num_stripes of 0 picks DEFAULT_STRIPES, and there are never more stripes than bins
+    ConcurrentJaggedArray(size_type n, unsigned int num_stripes = 0);
+    ~ConcurrentJaggedArray() { delete [] stripes; }
+
+    // safe to call from any number of threads at once
+    size_type numBins() const { return ja.num_bins; }
+    size_type numElementsInBin(size_type bin) const;
+    void addElement(size_type bin, const T& e) { append(bin, e); }
+    void addElement(size_type bin, T&& e) { append(bin, std::move(e)); }
+
+    // Only once no thread is adding any more: move everything added so far into a
+    // packed JaggedArray, using num_threads threads as pack() does. Within a bin the
+    // elements keep the order they were added in. This is left empty, ready to be
+    // filled again.
+    Array freeze(unsigned int num_threads = 1);
+
+private:
+    // the locks are shared between threads, so it cannot be copied
+    ConcurrentJaggedArray(const ConcurrentJaggedArray&);
+    ConcurrentJaggedArray& operator=(const ConcurrentJaggedArray&);
+
+    static const unsigned int DEFAULT_STRIPES = 1024;
+    // each lock on a cache line of its own, so threads taking neighbouring locks
+    // do not slow each other down
+    struct Stripe {
+        std::mutex lock;
+        char pad[64 - sizeof(std::mutex) % 64];
+    };
+    std::mutex& lock_of(size_type bin) const { return stripes[bin % num_stripes].lock; }
+    template<class U> void append(size_type bin, U&& e);
+
+    // REPRESENTATION
+    Array ja;                   // unpacked; counts[bin] and bin's array belong to bin's lock
+    Stripe* stripes;
+    unsigned int num_stripes;
+};
+
+template<class T, class Storage, class Offsets>
+ConcurrentJaggedArray<T, Storage, Offsets>::ConcurrentJaggedArray(size_type n, unsigned int num_stripes)
+    : ja(n), stripes(NULL), num_stripes(num_stripes == 0 ? DEFAULT_STRIPES : num_stripes) {
+    if(this->num_stripes > n)
+        this->num_stripes = n > 0 ? n : 1;
+    stripes = new Stripe[this->num_stripes];
+}
+
+template<class T, class Storage, class Offsets>
+size_type ConcurrentJaggedArray<T, Storage, Offsets>::numElementsInBin(size_type bin) const {
+    assert(bin < ja.num_bins);
+    std::lock_guard<std::mutex> guard(lock_of(bin));
+    return ja.counts[bin];
+}
+
+// only the bin's own entries of the unpacked arrays are touched, and the storage is
+// concurrent. The total number of elements is left to freeze(), so that producers
+// do not all contend for one counter.
+template<class T, class Storage, class Offsets>
+template<class U>
+void ConcurrentJaggedArray<T, Storage, Offsets>::append(size_type bin, U&& e) {
+    assert(bin < ja.num_bins);
+    std::lock_guard<std::mutex> guard(lock_of(bin));
+    ja.push_back(ja.unpacked_values[bin], ja.counts[bin], ja.capacities[bin], std::forward<U>(e));
+}
+
+// the replacement is built first, so if anything fails this keeps its elements
+template<class T, class Storage, class Offsets>
+typename ConcurrentJaggedArray<T, Storage, Offsets>::Array
+ConcurrentJaggedArray<T, Storage, Offsets>::freeze(unsigned int num_threads) {
+    Array frozen(ja.num_bins);
+    uint64_t total = 0;
+    for(size_type b=0; b<ja.num_bins; b++)
+        total += ja.counts[b];
+    if(total > uint64_t(typename Array::offset_type(-1))) {
+        std::cerr << "freeze: too many elements for the offsets of this JaggedArray" << std::endl;
+        exit(1);
+    }
+    ja.num_elements = total;
+    ja.pack(num_threads);
+    ja.swap(frozen);
+    return frozen;
+}
+
+#endif /* concurrent_jagged_array_h */
@@ -8,187 +8,823 @@
 #ifndef jagged_array_h
 #define jagged_array_h
 
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <new>
+#include <memory>
+#include <utility>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+#include <algorithm>
+
+#include "parallel_for.h"
+#include "storage.h"
+#include "offsets.h"
+#include "set_ops.h"
+
 // TYPEDEFS
 typedef unsigned int size_type;
 
-template <class T> class JaggedArray {
+// Binary file format of a packed JaggedArray, written by JaggedArray::save() and
+// memory mapped by JaggedArrayView. All fields are in the byte order of the writer.
+//   header    - this struct, at position 0
+//   offsets   - num_bins+1 uint64_t at offsets_pos; the last one is num_elements
+//   values    - num_elements T at values_pos, which is aligned to JAGGED_FILE_ALIGN
+struct JaggedArrayFileHeader {
+    char magic[8];              // JAGGED_FILE_MAGIC
+    uint32_t version;           // JAGGED_FILE_VERSION
+    uint32_t value_size;        // sizeof(T) of the writer
+    uint64_t num_bins;
+    uint64_t num_elements;
+    uint64_t offsets_pos;       // byte position of offsets[]
+    uint64_t values_pos;        // byte position of values[]
+    uint64_t byte_order;        // JAGGED_FILE_BYTE_ORDER as written by the writer
+    uint64_t reserved;
+};
+static const char JAGGED_FILE_MAGIC[8] = { 'J','A','G','G','E','D','\0','\0' };
+static const uint32_t JAGGED_FILE_VERSION = 1;
+static const uint64_t JAGGED_FILE_BYTE_ORDER = 0x0102030405060708ULL;
+static const uint64_t JAGGED_FILE_ALIGN = 64;
+
+// The elements of one bin of a JaggedArray or JaggedArrayView. They are contiguous
+// in both modes, so begin()/end() are plain pointers that std:: algorithms and
+// compilers handle well. Valid until the JaggedArray is next changed.
+template <class T> class JaggedBin {
+public:
+    typedef const T* const_iterator;
+    JaggedBin(const T* values, size_type count) : first(values), n(count) {}
+    const T* begin() const { return first; }
+    const T* end() const { return first + n; }
+    const T* data() const { return first; }
+    size_type size() const { return n; }
+    bool empty() const { return n == 0; }
+    const T& operator[](size_type i) const { assert(i < n); return first[i]; }
+private:
+    const T* first;
+    size_type n;
+};
+
+template <class T, class Storage, class Offsets> class ConcurrentJaggedArray;
+
+// Storage is the policy for the arrays of unpacked bins, see storage.h, and Offsets
+// the encoding of the packed offsets, see offsets.h. Offsets64 or CompactOffsets lift
+// the limit of 4G elements in all; a single bin still holds less than 4G.
+template <class T, class Storage = HeapStorage<T>, class Offsets = Offsets32> class JaggedArray {
 public:
+    typedef typename Offsets::offset_type offset_type;     // counts all the elements
+
     // CONSTRUCTORS, ASSIGNMNENT OPERATOR, & DESTRUCTOR
     // JaggedArray() { this->create(); }
     JaggedArray(size_type n) { this->create(n); }
     JaggedArray(const JaggedArray& ja) { copy(ja); }
+    JaggedArray(JaggedArray&& ja) noexcept { steal(ja); }
     JaggedArray& operator=(const JaggedArray& ja) {
-        if (this != &ja) { clear_all(); copy(ja); }
+        if (this != &ja) { JaggedArray tmp(ja); swap(tmp); }
+        return *this;
+    }
+    JaggedArray& operator=(JaggedArray&& ja) noexcept {
+        if (this != &ja) { clear_all(); steal(ja); }
         return *this;
     }
     ~JaggedArray() { clear_all(); }
+    void swap(JaggedArray& ja);
+    // a packed JaggedArray of num_bins bins from (bin, value) pairs such as
+    // std::pair<size_type, T>, keeping their order within a bin. See the definition
+    // for when it can use num_threads threads.
+    template<class Iter>
+    static JaggedArray fromPairs(Iter first, Iter last, size_type num_bins, unsigned int num_threads = 1);
 
     // MEMBER FUNCTIONS AND OTHER OPERATORS
     // accessors
-    size_type numElements() const { return num_elements; }
+    offset_type numElements() const { return num_elements; }
     size_type numBins() const { return num_bins; }
     size_type numElementsInBin(size_type bin) const;
     const T& getElement(size_type bin, size_type i) const;
     bool isPacked() const { return counts == NULL; }
+    offset_type numDeltaElements() const { return delta_elements; }  // packed changes not yet compacted
+    size_t offsetBytes() const { return offsets.bytes(); }    // memory taken by the packed offsets
+    JaggedBin<T> bin(size_type b) const { return JaggedBin<T>(bin_data(b), numElementsInBin(b)); }
+    const T* data() const;      // all elements as one array - only when packed without a delta
     void print() const;         // print JaggedArray
-    // modifiers - only when it's unpacked
-    void addElement(size_type bin, const T& e);
+
+    // iterates over all elements, bin by bin. Stepping within a bin is a pointer
+    // increment; the mode is only looked at when moving on to the next bin.
+    // It is a forward iterator only: an unpacked array or a delta keeps no running
+    // total of the bin sizes, so jumping n elements ahead could not be done in O(1).
+    // For random access use bin(b), or data() when packed without a delta; both
+    // give plain pointers.
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+        const_iterator() : ja(NULL), b(0), cur(NULL), last(NULL) {}
+        reference operator*() const { return *cur; }
+        pointer operator->() const { return cur; }
+        const_iterator& operator++() {
+            if(++cur == last) { b++; find_bin(); }
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator it(*this); ++*this; return it; }
+        bool operator==(const const_iterator& it) const { return cur == it.cur; }
+        bool operator!=(const const_iterator& it) const { return cur != it.cur; }
+        size_type binIndex() const { return b; }    // the bin of the current element
+    private:
+        friend class JaggedArray;
+        const_iterator(const JaggedArray* ja, size_type b) : ja(ja), b(b), cur(NULL), last(NULL) { find_bin(); }
+        void find_bin();    // move to the first element of bin b or of a later bin
+        const JaggedArray* ja;
+        size_type b;
+        const T* cur;       // NULL at the end
+        const T* last;      // the end of bin b
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(); }
+    // modifiers - a packed JaggedArray takes them into its delta, see compact()
+    void addElement(size_type bin, const T& e) { append(bin, e); }
+    void addElement(size_type bin, T&& e) { append(bin, std::move(e)); }
     void removeElement(size_type bin, size_type i);
+    void swapRemove(size_type bin, size_type i);    // O(1): the last element of bin takes slot i
+    // lazy removal in O(1): element i is marked but keeps its slot, so no index
+    // changes. Until the next explicit pack() or compact() squeezes all marked elements
+    // out in one pass, getElement(), bin() and the iterators still see them, and
+    // numElements() and numElementsInBin() still count them.
+    void markRemoved(size_type bin, size_type i);
+    bool isRemoved(size_type bin, size_type i) const;
+    offset_type numRemoved() const { return num_removed; }     // marked, not yet squeezed out
+    // modifiers - only when it's unpacked
+    void reserve(size_type bin, size_type n);  // make room for n elements in bin
+    void shrink_to_fit();   // release unused capacity of all bins
+    // file output - only when it's packed, and only for trivially copyable T
+    void save(const char* filename) const;   // see JaggedArrayFileHeader and JaggedArrayView
     // others
     void clear();   // clear this to the state of JaggedArray(num_bins) is called
-    void pack();
-    void unpack();
+    // pack() and unpack() can spread their work over num_threads threads
+    void pack(unsigned int num_threads = 1);
+    void unpack(unsigned int num_threads = 1);
+    // packed mode: fold the delta into a fresh packed_values[], leaving out marked
+    // elements. The delta is also folded by itself once more elements than the
+    // compact threshold have been added or removed since the last time, however
+    // large the bins they went into; a threshold of 0 (the default) means 1/8 of the
+    // packed elements, but at least 64. That keeps marked elements in their slots, so
+    // only an explicit pack() or compact() squeezes them out.
+    void compact();
+    void setCompactThreshold(size_type n) { compact_threshold = n; }
+    // sorted mode: packSorted() is pack() followed by sorting every bin with operator<.
+    // The bins stay sorted until unpack(): addElement() puts the element in its place
+    // and swapRemove() keeps the order, as removeElement() does. Marked elements are
+    // still seen by the searches and set operations until they are squeezed out.
+    void packSorted(unsigned int num_threads = 1);
+    bool isSorted() const { return sorted_insert != NULL; }
+    bool contains(size_type bin, const T& v) const;
+    size_type lowerBound(size_type bin, const T& v) const;    // index of the first element >= v
+    // the values in both bins / in either bin, each written once and in order to out.
+    // Bins of 32 bit integers are intersected with SSE2, see set_ops.h.
+    template<class OutIt> OutIt intersectBins(size_type a, size_type b, OutIt out) const;
+    template<class OutIt> OutIt unionBins(size_type a, size_type b, OutIt out) const;
 
 private:
+    friend class ConcurrentJaggedArray<T, Storage, Offsets>;   // fills the unpacked bins itself
+    struct Empty {};
+    explicit JaggedArray(Empty) { create_empty(); }
+
     // PRIVATE MEMBER FUNCTIONS
     void create(size_type n);
+    void create_empty();    // an empty packed array with 0 bins, as left by a move
     void clear_all();   // clears everything, releasing all arrays
-    void copy(const JaggedArray<T>& ja);
+    void copy(const JaggedArray& ja);
+    void steal(JaggedArray& ja);   // take over ja's arrays, leaving ja empty
+    template<class U> void append(size_type bin, U&& e);
+    void grow_bin(size_type bin, size_type new_capacity);   // reallocate bin to new_capacity
+    struct DeltaBin;
+    DeltaBin& delta_bin(size_type bin);   // start rewriting a packed bin in the delta
+    void maybe_compact();
+    void fold_delta(bool keep_marks);   // compact(), or with keep_marks leaving the marks be
+    void place_last(size_type bin, DeltaBin& d);    // sorted mode: sort in d's newest element
+    void check_sorted(const char* what) const;
+    const T* bin_data(size_type bin) const;   // the elements of bin, in either mode
+    struct Tombstones;
+    size_type num_marked(size_type bin) const { return tombstones == NULL ? 0 : tombstones[bin].count; }
+    void drop_mark(size_type bin, size_type i, size_type count, bool swap_last);
+    // a growable array of elements from storage: values[0..count) are constructed,
+    // capacity is allocated
+    template<class U> void push_back(T*& values, size_type& count, size_type& capacity, U&& e);
+    static void erase(T* values, size_type& count, size_type i);
+    static void swap_erase(T* values, size_type& count, size_type i);
+    void reallocate(T*& values, size_type count, size_type& capacity, size_type new_capacity);
+    // destroy the elements of a bin and give its array back to storage, unless storage
+    // gives every array back at once in release_all()
+    void free_bin(T* values, size_type count, size_type capacity) {
+        destroy(values, values + count);
+        if(!Storage::releases_all && capacity > 0)
+            storage.deallocate(values, capacity);
+    }
+    // when there is nothing to destroy and storage frees every array in release_all(),
+    // the bins need not be visited one by one to free them
+    static bool release_at_once() { return Storage::releases_all && std::is_trivially_destructible<T>::value; }
+    // elements live in uninitialized storage and are constructed/destroyed explicitly,
+    // so a T is never default constructed and moving elements between arrays is cheap.
+    // packed_values[] comes straight from operator new, bins come from storage.
+    static T* allocate_packed(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T))); }
+    static void deallocate_packed(T* p) { ::operator delete(p); }
+    static void destroy(T* first, T* last) { for(; first != last; ++first) first->~T(); }
+    static void transfer(T* first, T* last, T* dest);
+    static void transfer_live(T* first, size_type n, const Tombstones& t, T* dest);
 
     // REPRESENTATION
-    size_type num_elements;     // total number of elements stored in all the bins
+    offset_type num_elements;   // total number of elements stored in all the bins
     size_type num_bins;         // number of bins
     size_type* counts;         // for unpacked - array of integers
                                 // containing the counts of how many elements are in each bin
+    size_type* capacities;     // for unpacked - allocated size of each bin's array, >= counts[bin]
     T** unpacked_values;       // for unpacked - array of pointers to arrays that hold these elements
-    size_type* offsets;        // for packed - array of offsets for the start of each bin
+    Offsets offsets;           // for packed - offsets for the start of each bin, plus one more
+                                // holding the number of elements in packed_values
     T* packed_values;          // for packed - a single large array storing all elements, grouped by bin
+    // for packed - a bin changed since the last compact(). It has been moved out of
+    // packed_values as a whole and is read from values; values is NULL for other bins.
+    struct DeltaBin {
+        T* values;
+        size_type count;
+        size_type capacity;
+    };
+    DeltaBin* delta;            // for packed - NULL, or one DeltaBin per bin
+    offset_type delta_elements; // for packed - number of elements added to or removed from
+                                // the delta bins, not counting those moved in with them
+    // the slots of a bin marked by markRemoved(): bit i of bits is set for slot i
+    struct Tombstones {
+        Tombstones() : count(0) {}
+        bool test(size_type i) const { return i / 64 < bits.size() && (bits[i / 64] >> (i % 64) & 1); }
+        void set(size_type i, bool marked);
+        std::vector<uint64_t> bits;
+        size_type count;        // number of bits set
+    };
+    Tombstones* tombstones;     // NULL, or one Tombstones per bin
+    offset_type num_removed;    // marked elements in all the bins
+    size_type compact_threshold;
+    // for packed - set by packSorted() while every bin is sorted, to place_last(). A
+    // pointer, so that T needs operator< only for JaggedArrays that use packSorted().
+    void (JaggedArray::*sorted_insert)(size_type bin, DeltaBin& d);
+    Storage storage;            // where the arrays of unpacked bins and delta bins come from
 };
 
-template<class T>
-void JaggedArray<T>::create(size_type n) {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::create(size_type n) {
     num_elements = 0;
     num_bins = n;
     counts = new size_type[n];
+    capacities = new size_type[n];
     for(size_type b=0; b<num_bins; b++)
-        counts[b] = 0;
+        counts[b] = capacities[b] = 0;
     unpacked_values = new T*[n];
     for(size_type b=0; b<num_bins; b++)
         unpacked_values[b] = NULL;
-    offsets = NULL;
     packed_values = NULL;
+    delta = NULL;
+    delta_elements = compact_threshold = 0;
+    tombstones = NULL;
+    num_removed = 0;
+    sorted_insert = NULL;
 }
 
-template<class T>
-void JaggedArray<T>::copy(const JaggedArray<T>& ja) {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::create_empty() {
+    num_elements = num_bins = 0;
+    counts = capacities = NULL;
+    unpacked_values = NULL;
+    packed_values = NULL;
+    delta = NULL;
+    delta_elements = compact_threshold = 0;
+    tombstones = NULL;
+    num_removed = 0;
+    sorted_insert = NULL;
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::copy(const JaggedArray<T, Storage, Offsets>& ja) {
+    // start as an empty packed array, and only count what has been built so far,
+    // so clear_all() can release a partial copy if an allocation or a T copy throws
+    create_empty();
+    compact_threshold = ja.compact_threshold;
+    sorted_insert = ja.sorted_insert;
+    try {
+        if(ja.counts == NULL) {  // ja is packed
+            if(ja.offsets.empty())      // ja was moved from
+                return;
+            offsets = ja.offsets;
+            num_bins = ja.num_bins;
+            T* values = allocate_packed(offsets[num_bins]);
+            try {
+                std::uninitialized_copy(ja.packed_values, ja.packed_values + offsets[num_bins], values);
+            }
+            catch(...) {
+                deallocate_packed(values);
+                throw;
+            }
+            packed_values = values;
+            if(ja.delta != NULL) {
+                delta = new DeltaBin[num_bins];
+                for(size_type b=0; b<num_bins; b++) {
+                    delta[b].values = NULL;
+                    delta[b].count = delta[b].capacity = 0;
+                }
+                for(size_type b=0; b<num_bins; b++) {
+                    const DeltaBin& d = ja.delta[b];
+                    if(d.values == NULL)
+                        continue;
+                    size_type capacity = d.count > 0 ? d.count : 1;
+                    T* values = storage.allocate(capacity);
+                    try {
+                        std::uninitialized_copy(d.values, d.values + d.count, values);
+                    }
+                    catch(...) {
+                        storage.deallocate(values, capacity);
+                        throw;
+                    }
+                    delta[b].values = values;
+                    delta[b].count = d.count;
+                    delta[b].capacity = capacity;
+                }
+                delta_elements = ja.delta_elements;
+            }
+            num_elements = ja.num_elements;
+        }
+        else {  // ja is unpacked
+            counts = new size_type[ja.num_bins];
+            capacities = new size_type[ja.num_bins];
+            unpacked_values = new T*[ja.num_bins];
+            for(size_type b=0; b<ja.num_bins; b++){
+                counts[b] = capacities[b] = 0;
+                unpacked_values[b] = NULL;
+            }
+            num_bins = ja.num_bins;
+            for(size_type b=0; b<num_bins; b++){
+                // the copy only gets as much room as it needs
+                size_type n = ja.counts[b];
+                if(n > 0){
+                    unpacked_values[b] = storage.allocate(n);
+                    capacities[b] = n;
+                    std::uninitialized_copy(ja.unpacked_values[b], ja.unpacked_values[b] + n,
+                                            unpacked_values[b]);
+                    counts[b] = n;
+                    num_elements += n;
+                }
+            }
+        }
+        if(ja.tombstones != NULL) {
+            tombstones = new Tombstones[num_bins];
+            for(size_type b=0; b<num_bins; b++)
+                tombstones[b] = ja.tombstones[b];
+            num_removed = ja.num_removed;
+        }
+    }
+    catch(...) {
+        clear_all();
+        throw;
+    }
+}
+
+// take over the arrays of ja. ja is left as an empty packed JaggedArray with 0 bins,
+// which can only be destroyed or assigned to.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::steal(JaggedArray<T, Storage, Offsets>& ja) {
     num_elements = ja.num_elements;
     num_bins = ja.num_bins;
-    if(ja.counts == NULL) {  // ja is packed
-        counts = NULL;
-        unpacked_values = NULL;
-        offsets = new size_type[num_bins];
-        for(size_type b=0; b<num_bins; b++)
-            offsets[b] = ja.offsets[b];
-        packed_values = new T[num_elements];
-        for(size_type e=0; e<num_elements; e++)
-            packed_values[e] = ja.packed_values[e];
-    }
-    else {  // ja is unpacked
-        offsets = NULL;
-        packed_values = NULL;
-        counts = new size_type[num_bins];
-        unpacked_values = new T*[num_bins];
-        for(size_type b=0; b<num_bins; b++){
-            counts[b] = ja.counts[b];
-            if(counts[b] > 0){
-                unpacked_values[b] = new T[counts[b]];
-                for(size_type e=0; e<counts[b]; e++)
-                    unpacked_values[b][e] = ja.unpacked_values[b][e];
+    counts = ja.counts;
+    capacities = ja.capacities;
+    unpacked_values = ja.unpacked_values;
+    offsets.swap(ja.offsets);
+    packed_values = ja.packed_values;
+    delta = ja.delta;
+    delta_elements = ja.delta_elements;
+    tombstones = ja.tombstones;
+    num_removed = ja.num_removed;
+    compact_threshold = ja.compact_threshold;
+    sorted_insert = ja.sorted_insert;
+    storage.swap(ja.storage);
+    ja.num_elements = ja.num_bins = 0;
+    ja.counts = ja.capacities = NULL;
+    ja.unpacked_values = NULL;
+    ja.packed_values = NULL;
+    ja.delta = NULL;
+    ja.delta_elements = 0;
+    ja.tombstones = NULL;
+    ja.num_removed = 0;
+    ja.sorted_insert = NULL;
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::swap(JaggedArray<T, Storage, Offsets>& ja) {
+    std::swap(num_elements, ja.num_elements);
+    std::swap(num_bins, ja.num_bins);
+    std::swap(counts, ja.counts);
+    std::swap(capacities, ja.capacities);
+    std::swap(unpacked_values, ja.unpacked_values);
+    offsets.swap(ja.offsets);
+    std::swap(packed_values, ja.packed_values);
+    std::swap(delta, ja.delta);
+    std::swap(delta_elements, ja.delta_elements);
+    std::swap(tombstones, ja.tombstones);
+    std::swap(num_removed, ja.num_removed);
+    std::swap(compact_threshold, ja.compact_threshold);
+    std::swap(sorted_insert, ja.sorted_insert);
+    storage.swap(ja.storage);
+}
+
+// move-construct [first, last) into the uninitialized dest. Elements whose move
+// constructor may throw are copied instead, so if a T throws, whatever has been
+// built in dest is destroyed and the source is left as it was.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::transfer(T* first, T* last, T* dest) {
+    T* next = dest;
+    try {
+        for(; first != last; ++first, ++next)
+            new (static_cast<void*>(next)) T(std::move_if_noexcept(*first));
+    }
+    catch(...) {
+        destroy(dest, next);
+        throw;
+    }
+}
+
+// transfer() the elements of [first, first+n) whose slot t does not mark
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::transfer_live(T* first, size_type n, const Tombstones& t, T* dest) {
+    T* next = dest;
+    try {
+        for(size_type i=0; i<n; i++)
+            if(!t.test(i)) {
+                new (static_cast<void*>(next)) T(std::move_if_noexcept(first[i]));
+                ++next;
+            }
+    }
+    catch(...) {
+        destroy(dest, next);
+        throw;
+    }
+}
+
+// A counting sort: one pass over the pairs counts the bins, the other constructs each
+// value in its place. Serially the counts are kept in offsets[] itself, so the only
+// allocations are offsets[] and packed_values[] (and the encoding's, unless it uses
+// offsets[] as it is). With num_threads > 1 each thread takes a slice of the pairs
+// and keeps counts of its own for every bin; that is only done for trivially
+// copyable T, which cannot leave anything to clean up part way, and slicing is only
+// cheap for random access iterators.
+template<class T, class Storage, class Offsets>
+template<class Iter>
+JaggedArray<T, Storage, Offsets> JaggedArray<T, Storage, Offsets>::fromPairs(Iter first, Iter last,
+                                                                             size_type num_bins,
+                                                                             unsigned int num_threads) {
+    size_t n = std::distance(first, last);
+    if(n > size_t(offset_type(-1))) {
+        std::cerr << "fromPairs: too many elements for the offsets of this JaggedArray" << std::endl;
+        exit(1);
+    }
+    unsigned int num_ranges = num_threads < 1 ? 1 : num_threads;
+    if(!std::is_trivially_copyable<T>::value
+       || !std::is_nothrow_constructible<T, decltype(((*first).second))>::value)
+        num_ranges = 1;
+    if(num_ranges > n)
+        num_ranges = n > 0 ? n : 1;
+
+    offset_type* offsets = new offset_type[size_t(num_bins) + 1];
+    T* values = NULL;
+    try {
+        if(num_ranges == 1) {
+            // count bin b in offsets[b+2] and sum up, so offsets[b+1] is where bin b starts.
+            // Placing the values then moves offsets[b+1] on to the end of bin b.
+            for(size_type b=0; b<=num_bins; b++)
+                offsets[b] = 0;
+            for(Iter it=first; it!=last; ++it) {
+                size_type bin = (*it).first;
+                if(bin >= num_bins) {
+                    std::cerr << "fromPairs: bin " << bin << " is out of range" << std::endl;
+                    exit(1);
+                }
+                if(bin + 1 < num_bins)
+                    offsets[bin+2]++;
+            }
+            for(size_type b=2; b<=num_bins; b++)
+                offsets[b] += offsets[b-1];
+            values = allocate_packed(n);
+            size_t placed = 0;
+            try {
+                for(Iter it=first; it!=last; ++it, ++placed) {
+                    size_type bin = (*it).first;
+                    new (static_cast<void*>(values + offsets[bin+1])) T((*it).second);
+                    offsets[bin+1]++;
+                }
             }
+            catch(...) {
+                // walk the placed pairs again, taking each bin's end back one by one
+                Iter it = first;
+                for(size_t i=0; i<placed; i++, ++it) {
+                    size_type bin = (*it).first;
+                    values[--offsets[bin+1]].~T();
+                }
+                throw;
+            }
+        }
+        else {
+            std::vector<std::vector<offset_type> > cursors(num_ranges);
+            parallel_for(num_ranges, n, [&](unsigned int t, size_t begin, size_t end) {
+                std::vector<offset_type> counts(num_bins, 0);
+                Iter it = first;
+                std::advance(it, begin);
+                for(size_t i=begin; i<end; i++, ++it) {
+                    size_type bin = (*it).first;
+                    if(bin >= num_bins) {
+                        std::cerr << "fromPairs: bin " << bin << " is out of range" << std::endl;
+                        exit(1);
+                    }
+                    counts[bin]++;
+                }
+                cursors[t].swap(counts);
+            });
+            // offsets[] with a prefix sum over ranges of bins as in pack(); each slice's
+            // counts turn into where it puts its first value of each bin
+            std::vector<offset_type> range_offsets(num_ranges + 1, 0);
+            parallel_for(num_ranges, num_bins, [&](unsigned int t, size_t begin, size_t end) {
+                offset_type sum = 0;
+                for(size_t b=begin; b<end; b++)
+                    for(unsigned int r=0; r<num_ranges; r++)
+                        sum += cursors[r][b];
+                range_offsets[t+1] = sum;
+            });
+            for(unsigned int t=0; t<num_ranges; t++)
+                range_offsets[t+1] += range_offsets[t];
+            parallel_for(num_ranges, num_bins, [&](unsigned int t, size_t begin, size_t end) {
+                offset_type offset = range_offsets[t];
+                for(size_t b=begin; b<end; b++) {
+                    offsets[b] = offset;
+                    for(unsigned int r=0; r<num_ranges; r++) {
+                        offset_type count = cursors[r][b];
+                        cursors[r][b] = offset;
+                        offset += count;
+                    }
+                }
+            });
+            offsets[num_bins] = n;
+            values = allocate_packed(n);
+            // trivially copyable values need no destroying if this fails
+            parallel_for(num_ranges, n, [&](unsigned int t, size_t begin, size_t end) {
+                std::vector<offset_type>& cursor = cursors[t];
+                Iter it = first;
+                std::advance(it, begin);
+                for(size_t i=begin; i<end; i++, ++it)
+                    new (static_cast<void*>(values + cursor[(*it).first]++)) T((*it).second);
+            });
         }
     }
+    catch(...) {
+        deallocate_packed(values);
+        delete [] offsets;
+        throw;
+    }
+    Offsets encoded;
+    try {
+        encoded.adopt(offsets, num_bins);   // takes offsets over, even if it throws
+    }
+    catch(...) {
+        destroy(values, values + n);
+        deallocate_packed(values);
+        throw;
+    }
+    JaggedArray ja((Empty()));
+    ja.offsets.swap(encoded);
+    ja.packed_values = values;
+    ja.num_bins = num_bins;
+    ja.num_elements = n;
+    return ja;
 }
 
-template<class T>
-void JaggedArray<T>::clear_all() {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::clear_all() {
     if( counts == NULL ) {   // packed mode
-        delete [] offsets; offsets = NULL;
-        delete [] packed_values; packed_values = NULL;
+        if(packed_values != NULL) {
+            destroy(packed_values, packed_values + offsets[num_bins]);
+            deallocate_packed(packed_values); packed_values = NULL;
+        }
+        offsets.clear();
+        if(delta != NULL) {
+            if(!release_at_once())
+                for(size_type b=0; b<num_bins; b++)
+                    if(delta[b].values != NULL)
+                        free_bin(delta[b].values, delta[b].count, delta[b].capacity);
+            delete [] delta; delta = NULL;
+        }
+        delta_elements = 0;
     }
     else {  // unpacked mode
-        for(size_type b=0; b<num_bins; b++)
-            if(counts[b] > 0) {
-                delete [] unpacked_values[b];
-            }
+        if(!release_at_once())
+            for(size_type b=0; b<num_bins; b++)
+                if(capacities[b] > 0)
+                    free_bin(unpacked_values[b], counts[b], capacities[b]);
         delete [] unpacked_values; unpacked_values = NULL;
+        delete [] capacities; capacities = NULL;
         delete [] counts; counts = NULL;
     }
+    storage.release_all();
+    delete [] tombstones; tombstones = NULL;
+    num_removed = 0;
     num_elements = num_bins = 0;
 }
 
-template<class T>
-void JaggedArray<T>::clear() {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::clear() {
     if(counts == NULL) {    // packed mode
         std::cerr << "Clear cannot be done to a packed JaggedArray; unpack it first." << std::endl;
         exit(1);
     }
     num_elements = 0;
     // num_bins = 0;
-    for(size_type b=0; b<num_bins; b++)
-        if(counts[b] > 0) {
-            delete [] unpacked_values[b];
-            counts[b] = 0;
-        }
+    if(!release_at_once())
+        for(size_type b=0; b<num_bins; b++)
+            if(capacities[b] > 0)
+                free_bin(unpacked_values[b], counts[b], capacities[b]);
+    storage.release_all();
+    for(size_type b=0; b<num_bins; b++) {
+        unpacked_values[b] = NULL;
+        counts[b] = capacities[b] = 0;
+    }
+    delete [] tombstones; tombstones = NULL;
+    num_removed = 0;
     // leave the 2 arrays there, returning to the state after JA(num_bins) is called
 }
 
-template<class T>
-void JaggedArray<T>::pack() {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::pack(unsigned int num_threads) {
     if(counts == NULL) {    // packed mode
         std::cerr << "JaggedArray is already packed; cannot pack it again." << std::endl;
         exit(1);
     }
-    // create offsets[]
-    offsets = new size_type[num_bins];
-    offsets[0] = 0;     // always start with 0
-    for(size_type b=1, offset=0; b<num_bins; b++) {
-        offset += counts[b-1];
-        offsets[b] = offset;
-    }
-    // create packed_values[]
-    packed_values = new T[num_elements];
-    for(size_type b=0, offset=0; b<num_bins; b++)
-        for(size_type e=0; e<counts[b]; e++)
-            packed_values[offset++] = unpacked_values[b][e];
-    // destroy packed arrays
-    for(size_type b=0; b<num_bins; b++)
-        if(counts[b] != 0)
-            delete [] unpacked_values[b];
+    // each thread works on its own contiguous range of bins
+    unsigned int num_ranges = num_threads < 1 ? 1 : num_threads;
+    if(num_ranges > num_bins)
+        num_ranges = num_bins > 0 ? num_bins : 1;
+    offset_type* new_offsets = new offset_type[size_t(num_bins) + 1];
+    Offsets encoded;
+    T* new_values = NULL;
+    std::vector<offset_type> range_offsets(num_ranges + 1, 0);
+    std::vector<offset_type> range_done(num_ranges, 0);    // elements moved so far by each range
+    // marked elements are left behind
+    offset_type live_elements = num_elements - num_removed;
+    try {
+        // create offsets[] with a prefix sum: each range adds up its counts, a short
+        // serial scan turns those sums into where each range starts, and then each
+        // range fills in its own offsets while it moves its elements
+        parallel_for(num_ranges, num_bins, [&](unsigned int t, size_t begin, size_t end) {
+            offset_type sum = 0;
+            for(size_t b=begin; b<end; b++)
+                sum += counts[b] - num_marked(b);
+            range_offsets[t+1] = sum;
+        });
+        for(unsigned int t=0; t<num_ranges; t++)
+            range_offsets[t+1] += range_offsets[t];
+        new_offsets[num_bins] = live_elements;
+        // move the elements into packed_values[]. If that fails part way, the unpacked
+        // arrays are still intact (see transfer), so drop the new arrays and stay unpacked.
+        new_values = allocate_packed(live_elements);
+        parallel_for(num_ranges, num_bins, [&](unsigned int t, size_t begin, size_t end) {
+            offset_type offset = range_offsets[t];
+            for(size_t b=begin; b<end; b++) {
+                new_offsets[b] = offset;
+                if(num_marked(b) > 0)
+                    transfer_live(unpacked_values[b], counts[b], tombstones[b], new_values + offset);
+                else
+                    transfer(unpacked_values[b], unpacked_values[b] + counts[b], new_values + offset);
+                offset += counts[b] - num_marked(b);
+                range_done[t] = offset - range_offsets[t];
+            }
+        });
+        offset_type* plain = new_offsets;
+        new_offsets = NULL;     // adopt() takes it over, even if it throws
+        encoded.adopt(plain, num_bins);
+    }
+    catch(...) {
+        if(new_values != NULL) {
+            for(unsigned int t=0; t<num_ranges; t++)
+                destroy(new_values + range_offsets[t], new_values + range_offsets[t] + range_done[t]);
+            deallocate_packed(new_values);
+        }
+        delete [] new_offsets;
+        throw;
+    }
+    // destroy unpacked arrays. Threads may only give arrays back to storage that
+    // allows it, or that leaves it all to release_all().
+    if(!release_at_once()) {
+        unsigned int free_ranges = Storage::concurrent || Storage::releases_all ? num_ranges : 1;
+        parallel_for(free_ranges, num_bins, [&](unsigned int, size_t begin, size_t end) {
+            for(size_t b=begin; b<end; b++)
+                if(capacities[b] != 0)
+                    free_bin(unpacked_values[b], counts[b], capacities[b]);
+        });
+    }
+    storage.release_all();
     delete [] unpacked_values; unpacked_values = NULL;
+    delete [] capacities; capacities = NULL;
     delete [] counts; counts = NULL;
+    offsets.swap(encoded);
+    packed_values = new_values;
+    delete [] tombstones; tombstones = NULL;
+    num_removed = 0;
+    num_elements = live_elements;
 }
 
-template<class T>
-void JaggedArray<T>::unpack() {
-    if(offsets == NULL) {    // unpacked mode
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::unpack(unsigned int num_threads) {
+    if(counts != NULL) {    // unpacked mode
         std::cerr << "JaggedArray is already unpacked; cannot unpack it again." << std::endl;
         exit(1);
     }
     // std::cout << "DEBUG: unpack a JaggedArray bins=" << num_bins << " and nums=" << num_elements << std::endl;
-    // create counts[]
-    counts = new size_type[num_bins];
-    for(size_type b=0; b<num_bins-1; b++) {
-        counts[b] = offsets[b+1] - offsets[b];
-    }
-    counts[num_bins-1] = num_elements - offsets[num_bins-1];
-    // create unpacked_values[]
-    unpacked_values = new T*[num_bins];
-    size_type offset = 0;
-    for(size_type b=0; b<num_bins; b++) {
-        size_type bin_size = counts[b];
-        if(bin_size > 0) {
-            unpacked_values[b] = new T[bin_size];
-            for(size_type e=0; e<bin_size; e++)
-                unpacked_values[b][e] = packed_values[offset++];
+    unsigned int num_ranges = num_threads < 1 ? 1 : num_threads;
+    if(num_ranges > num_bins)
+        num_ranges = num_bins > 0 ? num_bins : 1;
+    // create counts[], capacities[] and unpacked_values[], each bin exactly as large
+    // as it needs to be. Each thread fills in its own range of bins. Bins in the delta
+    // are handed over as they are, after all the others have been moved out of
+    // packed_values[].
+    size_type* new_counts = NULL;
+    size_type* new_capacities = NULL;
+    T** new_values = NULL;
+    try {
+        new_counts = new size_type[num_bins];
+        new_capacities = new size_type[num_bins];
+        new_values = new T*[num_bins];
+        for(size_type b=0; b<num_bins; b++) {
+            new_values[b] = NULL;
+            new_counts[b] = new_capacities[b] = 0;
+        }
+        // storage that threads cannot share hands out all the arrays up front
+        for(size_type b=0; !Storage::concurrent && b<num_bins; b++) {
+            size_type bin_size = offsets[b+1] - offsets[b];
+            if(bin_size > 0 && (delta == NULL || delta[b].values == NULL)) {
+                new_values[b] = storage.allocate(bin_size);
+                new_capacities[b] = bin_size;
+            }
         }
+        parallel_for(num_ranges, num_bins, [&](unsigned int, size_t begin, size_t end) {
+            for(size_t b=begin; b<end; b++) {
+                size_type bin_size = offsets[b+1] - offsets[b];
+                if(bin_size > 0 && (delta == NULL || delta[b].values == NULL)) {
+                    if(Storage::concurrent) {
+                        new_values[b] = storage.allocate(bin_size);
+                        new_capacities[b] = bin_size;
+                    }
+                    transfer(packed_values + offsets[b], packed_values + offsets[b+1], new_values[b]);
+                    new_counts[b] = bin_size;
+                }
+            }
+        });
     }
-    // destroy unpacked arrays
-    delete [] offsets; offsets = NULL;
-    delete [] packed_values; packed_values = NULL;
+    catch(...) {
+        // the bins that got their elements are built, others at most have an
+        // array; the packed arrays are untouched
+        if(new_values != NULL)
+            for(size_type b=0; b<num_bins; b++)
+                if(new_values[b] != NULL) {
+                    destroy(new_values[b], new_values[b] + new_counts[b]);
+                    storage.deallocate(new_values[b], new_capacities[b]);
+                }
+        delete [] new_values;
+        delete [] new_capacities;
+        delete [] new_counts;
+        throw;
+    }
+    // hand over the delta and destroy the packed arrays
+    parallel_for(num_ranges, num_bins, [&](unsigned int, size_t begin, size_t end) {
+        if(delta != NULL)
+            for(size_t b=begin; b<end; b++)
+                if(delta[b].values != NULL) {
+                    new_values[b] = delta[b].values;
+                    new_counts[b] = delta[b].count;
+                    new_capacities[b] = delta[b].capacity;
+                }
+        if(begin < end)
+            destroy(packed_values + offsets[begin], packed_values + offsets[end]);
+    });
+    delete [] delta; delta = NULL;
+    delta_elements = 0;
+    deallocate_packed(packed_values); packed_values = NULL;
+    offsets.clear();
+    counts = new_counts;
+    capacities = new_capacities;
+    unpacked_values = new_values;
+    sorted_insert = NULL;
 }
 
-template<class T>
-void JaggedArray<T>::print() const {
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::print() const {
     if(counts == NULL) {    // packed mode
         std::cout << "packed JaggedArray" << std::endl;
         std::cout << "  num_bins: " << num_bins << std::endl;
@@ -198,10 +834,23 @@ void JaggedArray<T>::print() const {
             std::cout << offsets[i] << " ";
         std::cout << std::endl;
         std::cout << "  values:   ";
-        for(size_type i=0; i<num_elements; i++) {
+        for(offset_type i=0; i<offsets[num_bins]; i++) {
             std::cout << packed_values[i];
         }
-        std::cout << std::endl << std::endl;
+        std::cout << std::endl;
+        if(delta != NULL) {
+            // bins rewritten since the last compact(), which replace their part of values
+            std::cout << "  delta:    ";
+            for(size_type b=0; b<num_bins; b++)
+                if(delta[b].values != NULL) {
+                    std::cout << b << ":";
+                    for(size_type i=0; i<delta[b].count; i++)
+                        std::cout << delta[b].values[i];
+                    std::cout << " ";
+                }
+            std::cout << std::endl;
+        }
+        std::cout << std::endl;
     }
     else {  // unpacked mode
         std::cout << "unpacked JaggedArray" << std::endl;
@@ -237,83 +886,541 @@ void JaggedArray<T>::print() const {
     }
 }
 
-// add an element to the unpacked JaggedArray.
-template<class T>
-void JaggedArray<T>::addElement(size_type bin, const T& e) {
+// add an element to the JaggedArray, copying or moving it in.
+template<class T, class Storage, class Offsets>
+template<class U>
+void JaggedArray<T, Storage, Offsets>::append(size_type bin, U&& e) {
+    assert(bin < num_bins);
     if(counts == NULL) {    // packed mode
-        std::cerr << "addElement cannot be done to a packed JaggedArray; unpack it first." << std::endl;
-        exit(1);
-    }
-    T* old_array = unpacked_values[bin];
-    // allocate a new array, copy the existing elements over, and append the new element
-    unpacked_values[bin] = new T[counts[bin] + 1];
-    if( counts[bin] != 0 )   {
-        // copy from the old array
-        for( size_type i=0; i<counts[bin]; i++)   {
-            unpacked_values[bin][i] = old_array[i];
+        if(delta == NULL || delta[bin].values == NULL) {
+            // e may be an element of this very bin, which delta_bin() is about to move
+            T copy(std::forward<U>(e));
+            DeltaBin& d = delta_bin(bin);
+            push_back(d.values, d.count, d.capacity, std::move(copy));
         }
-        // delete the old array
-        delete [] old_array;
+        else {
+            DeltaBin& d = delta[bin];
+            push_back(d.values, d.count, d.capacity, std::forward<U>(e));
+        }
+        if(sorted_insert != NULL)
+            (this->*sorted_insert)(bin, delta[bin]);
+        delta_elements++;
+        num_elements++;
+        maybe_compact();
+        return;
     }
-    unpacked_values[bin][counts[bin]] = e;
-    counts[bin]++;
+    push_back(unpacked_values[bin], counts[bin], capacities[bin], std::forward<U>(e));
     num_elements++;
 }
 
-// remove an element from the unpacked JaggedArray.
-template<class T>
-void JaggedArray<T>::removeElement(size_type bin, size_type i) {
+// remove an element from the JaggedArray.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::removeElement(size_type bin, size_type i) {
+    if(i >= numElementsInBin(bin))    {
+        std::cerr << "Cannot remove " << i << "th element in Bin " << bin << ", which only has "
+                  << numElementsInBin(bin) << "." << std::endl;
+        exit(1);
+    }
     if(counts == NULL) {    // packed mode
-        std::cerr << "removeElement cannot be done to a packed JaggedArray; unpack it first." << std::endl;
+        DeltaBin& d = delta_bin(bin);
+        drop_mark(bin, i, d.count, false);
+        erase(d.values, d.count, i);
+        delta_elements++;
+        num_elements--;
+        maybe_compact();
+        return;
+    }
+    drop_mark(bin, i, counts[bin], false);
+    erase(unpacked_values[bin], counts[bin], i);
+    num_elements--;
+}
+
+// remove element i of bin by moving the last element of the bin into its place.
+// A packed bin is moved into the delta first, as for removeElement().
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::swapRemove(size_type bin, size_type i) {
+    if(i >= numElementsInBin(bin))    {
+        std::cerr << "Cannot remove " << i << "th element in Bin " << bin << ", which only has "
+                  << numElementsInBin(bin) << "." << std::endl;
         exit(1);
     }
-    if(i >= counts[bin])    {
+    if(isSorted()) {
+        removeElement(bin, i);
+        return;
+    }
+    if(counts == NULL) {    // packed mode
+        DeltaBin& d = delta_bin(bin);
+        drop_mark(bin, i, d.count, true);
+        swap_erase(d.values, d.count, i);
+        delta_elements++;
+        num_elements--;
+        maybe_compact();
+        return;
+    }
+    drop_mark(bin, i, counts[bin], true);
+    swap_erase(unpacked_values[bin], counts[bin], i);
+    num_elements--;
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::markRemoved(size_type bin, size_type i) {
+    if(i >= numElementsInBin(bin))    {
         std::cerr << "Cannot remove " << i << "th element in Bin " << bin << ", which only has "
-                  << counts[bin] << "." << std::endl;
+                  << numElementsInBin(bin) << "." << std::endl;
         exit(1);
     }
-    assert(counts[bin] > 0);
-    if(counts[bin] == 1) {  // just one element. Destroy the array.
-        delete [] unpacked_values[bin];
-    }
-    else {  // more than 1 elements in the bin. Remove it
-        T* old_array = unpacked_values[bin];
-        // allocate a new array with size-1
-        unpacked_values[bin] = new T[counts[bin] - 1];
-        // copy remaining elements over
-        for( size_type j=0; j<i; j++)   {
-            unpacked_values[bin][j] = old_array[j];
+    if(tombstones == NULL)
+        tombstones = new Tombstones[num_bins];
+    Tombstones& t = tombstones[bin];
+    if(t.test(i))
+        return;
+    t.set(i, true);
+    t.count++;
+    num_removed++;
+}
+
+template<class T, class Storage, class Offsets>
+bool JaggedArray<T, Storage, Offsets>::isRemoved(size_type bin, size_type i) const {
+    assert(bin < num_bins && i < numElementsInBin(bin));
+    return tombstones != NULL && tombstones[bin].test(i);
+}
+
+// slot i of a bin of count slots is being removed: forget its mark, and move the
+// marks of the slots after it down one, or with swap_last the mark of the last
+// slot into slot i, the way the elements move
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::drop_mark(size_type bin, size_type i, size_type count, bool swap_last) {
+    if(num_marked(bin) == 0)
+        return;
+    Tombstones& t = tombstones[bin];
+    if(t.test(i)) {
+        t.count--;
+        num_removed--;
+    }
+    if(swap_last)
+        t.set(i, t.test(count-1));
+    else
+        for(size_type j=i+1; j<count; j++)
+            t.set(j-1, t.test(j));
+    t.set(count-1, false);
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::Tombstones::set(size_type i, bool marked) {
+    if(i / 64 >= bits.size()) {
+        if(!marked)
+            return;
+        bits.resize(i / 64 + 1, 0);
+    }
+    if(marked)
+        bits[i / 64] |= uint64_t(1) << (i % 64);
+    else
+        bits[i / 64] &= ~(uint64_t(1) << (i % 64));
+}
+
+// make sure bin can hold at least n elements without reallocating.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::reserve(size_type bin, size_type n) {
+    if(counts == NULL) {    // packed mode
+        std::cerr << "reserve cannot be done to a packed JaggedArray; unpack it first." << std::endl;
+        exit(1);
+    }
+    assert(bin < num_bins);
+    if( n > capacities[bin] )
+        grow_bin(bin, n);
+}
+
+// shrink every bin's array to exactly the number of elements it holds.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::shrink_to_fit() {
+    if(counts == NULL)      // packed mode has no spare capacity
+        return;
+    for(size_type b=0; b<num_bins; b++)
+        if( capacities[b] != counts[b] )
+            grow_bin(b, counts[b]);
+}
+
+// reallocate the array of bin to hold new_capacity elements, keeping its contents.
+// new_capacity of 0 releases the array.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::grow_bin(size_type bin, size_type new_capacity) {
+    reallocate(unpacked_values[bin], counts[bin], capacities[bin], new_capacity);
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::compact() {
+    if(counts != NULL) {    // unpacked mode
+        std::cerr << "compact cannot be done to an unpacked JaggedArray; pack it first." << std::endl;
+        exit(1);
+    }
+    fold_delta(false);
+}
+
+// fold the delta into a fresh packed_values[]. Marked elements are left out, unless
+// keep_marks keeps them and their marks where they are, so no index changes.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::fold_delta(bool keep_marks) {
+    if(delta == NULL && (keep_marks || tombstones == NULL))
+        return;
+    // build the new offsets[] and packed_values[] from the old ones and the delta.
+    // As in pack(), a T that throws leaves everything as it was.
+    offset_type* new_offsets = new offset_type[size_t(num_bins) + 1];
+    new_offsets[0] = 0;
+    for(size_type b=0; b<num_bins; b++)
+        new_offsets[b+1] = new_offsets[b] + numElementsInBin(b) - (keep_marks ? 0 : num_marked(b));
+    Offsets encoded;
+    T* new_values = NULL;
+    offset_type offset = 0;
+    try {
+        new_values = allocate_packed(new_offsets[num_bins]);
+        for(size_type b=0; b<num_bins; b++) {
+            T* first = delta != NULL && delta[b].values != NULL ? delta[b].values : packed_values + offsets[b];
+            if(!keep_marks && num_marked(b) > 0)
+                transfer_live(first, numElementsInBin(b), tombstones[b], new_values + offset);
+            else
+                transfer(first, first + numElementsInBin(b), new_values + offset);
+            offset = new_offsets[b+1];
         }
-        for( size_type j=i+1; j<counts[bin]; j++)   {
-            unpacked_values[bin][j-1] = old_array[j];
+        offset_type* plain = new_offsets;
+        new_offsets = NULL;     // adopt() takes it over, even if it throws
+        encoded.adopt(plain, num_bins);
+    }
+    catch(...) {
+        if(new_values != NULL) {
+            destroy(new_values, new_values + offset);
+            deallocate_packed(new_values);
         }
+        delete [] new_offsets;
+        throw;
     }
-    counts[bin]--;
-    num_elements--;
+    // clear_all() destroys the old arrays and the marks, unless they are kept
+    size_type bins = num_bins;
+    offset_type elements = num_elements;
+    Tombstones* marks = NULL;
+    offset_type removed = 0;
+    if(keep_marks) {
+        std::swap(marks, tombstones);
+        removed = num_removed;
+    }
+    else
+        elements -= num_removed;
+    clear_all();
+    num_bins = bins;
+    num_elements = elements;
+    tombstones = marks;
+    num_removed = removed;
+    offsets.swap(encoded);
+    packed_values = new_values;
+}
+
+// the delta entry of a packed bin, moving the bin out of packed_values[] the first time
+template<class T, class Storage, class Offsets>
+typename JaggedArray<T, Storage, Offsets>::DeltaBin& JaggedArray<T, Storage, Offsets>::delta_bin(size_type bin) {
+    assert(counts == NULL && bin < num_bins);
+    if(delta == NULL) {
+        delta = new DeltaBin[num_bins];
+        for(size_type b=0; b<num_bins; b++) {
+            delta[b].values = NULL;
+            delta[b].count = delta[b].capacity = 0;
+        }
+    }
+    DeltaBin& d = delta[bin];
+    if(d.values == NULL) {
+        // room for one more, since the bin is usually being added to.
+        // The moved-from elements stay in packed_values[] until it is destroyed.
+        size_type n = offsets[bin+1] - offsets[bin];
+        T* values = storage.allocate(n + 1);
+        try {
+            transfer(packed_values + offsets[bin], packed_values + offsets[bin+1], values);
+        }
+        catch(...) {
+            storage.deallocate(values, n + 1);
+            throw;
+        }
+        d.values = values;
+        d.count = n;
+        d.capacity = n + 1;
+    }
+    return d;
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::maybe_compact() {
+    offset_type threshold = compact_threshold;
+    if(threshold == 0) {
+        threshold = offsets[num_bins] / 8;
+        if(threshold < 64)
+            threshold = 64;
+    }
+    if(delta_elements > threshold)
+        fold_delta(true);
+}
+
+// move the last element of delta bin d back past the elements greater than it,
+// and its mark with it
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::place_last(size_type bin, DeltaBin& d) {
+    T* last = d.values + d.count - 1;
+    size_type pos = std::upper_bound(d.values, last, *last) - d.values;
+    if(pos == d.count - 1)
+        return;
+    std::rotate(d.values + pos, last, last + 1);
+    if(num_marked(bin) > 0) {
+        Tombstones& t = tombstones[bin];
+        for(size_type j=d.count-1; j>pos; j--)
+            t.set(j, t.test(j-1));
+        t.set(pos, false);
+    }
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::check_sorted(const char* what) const {
+    if(!isSorted()) {
+        std::cerr << what << " needs a sorted JaggedArray; pack it with packSorted() first." << std::endl;
+        exit(1);
+    }
+}
+
+// sort the bins after packing, when each bin is one contiguous range of packed_values[]
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::packSorted(unsigned int num_threads) {
+    pack(num_threads);
+    unsigned int num_ranges = num_threads < 1 ? 1 : num_threads;
+    if(num_ranges > num_bins)
+        num_ranges = num_bins > 0 ? num_bins : 1;
+    parallel_for(num_ranges, num_bins, [&](unsigned int, size_t begin, size_t end) {
+        for(size_t b=begin; b<end; b++)
+            std::sort(packed_values + offsets[b], packed_values + offsets[b+1]);
+    });
+    sorted_insert = &JaggedArray::place_last;
 }
 
-template<class T>
-size_type JaggedArray<T>::numElementsInBin(size_type bin) const {
+template<class T, class Storage, class Offsets>
+bool JaggedArray<T, Storage, Offsets>::contains(size_type bin, const T& v) const {
+    check_sorted("contains");
+    assert(bin < num_bins);
+    const T* first = bin_data(bin);
+    const T* last = first + numElementsInBin(bin);
+    first = std::lower_bound(first, last, v);
+    return first != last && !(v < *first);
+}
+
+template<class T, class Storage, class Offsets>
+size_type JaggedArray<T, Storage, Offsets>::lowerBound(size_type bin, const T& v) const {
+    check_sorted("lowerBound");
+    assert(bin < num_bins);
+    const T* first = bin_data(bin);
+    return std::lower_bound(first, first + numElementsInBin(bin), v) - first;
+}
+
+template<class T, class Storage, class Offsets>
+template<class OutIt>
+OutIt JaggedArray<T, Storage, Offsets>::intersectBins(size_type a, size_type b, OutIt out) const {
+    check_sorted("intersectBins");
+    assert(a < num_bins && b < num_bins);
+    return intersect_sorted(bin_data(a), numElementsInBin(a), bin_data(b), numElementsInBin(b), out);
+}
+
+template<class T, class Storage, class Offsets>
+template<class OutIt>
+OutIt JaggedArray<T, Storage, Offsets>::unionBins(size_type a, size_type b, OutIt out) const {
+    check_sorted("unionBins");
+    assert(a < num_bins && b < num_bins);
+    return union_sorted(bin_data(a), numElementsInBin(a), bin_data(b), numElementsInBin(b), out);
+}
+
+// append e to a growable array
+template<class T, class Storage, class Offsets>
+template<class U>
+void JaggedArray<T, Storage, Offsets>::push_back(T*& values, size_type& count, size_type& capacity, U&& e) {
+    if( count < capacity ) {
+        new (static_cast<void*>(values + count)) T(std::forward<U>(e));
+        count++;
+        return;
+    }
+    // grow geometrically when full, so n appends cost O(n) moves in total.
+    // The new element is built before the old ones are moved, since e may be one of them.
+    size_type new_capacity = capacity == 0 ? 1 : 2 * capacity;
+    T* new_array = storage.allocate(new_capacity);
+    try {
+        new (static_cast<void*>(new_array + count)) T(std::forward<U>(e));
+        try {
+            transfer(values, values + count, new_array);
+        }
+        catch(...) {
+            new_array[count].~T();
+            throw;
+        }
+    }
+    catch(...) {
+        storage.deallocate(new_array, new_capacity);
+        throw;
+    }
+    if( capacity > 0 ) {
+        destroy(values, values + count);
+        storage.deallocate(values, capacity);
+    }
+    values = new_array;
+    capacity = new_capacity;
+    count++;
+}
+
+// remove the ith element of a growable array, shifting the rest down in place.
+// The capacity is kept for later appends.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::erase(T* values, size_type& count, size_type i) {
+    assert(i < count);
+    for( size_type j=i+1; j<count; j++)   {
+        values[j-1] = std::move(values[j]);
+    }
+    values[count-1].~T();
+    count--;
+}
+
+// remove the ith element of a growable array by moving the last one into its place
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::swap_erase(T* values, size_type& count, size_type i) {
+    assert(i < count);
+    if( i != count-1 )
+        values[i] = std::move(values[count-1]);
+    values[count-1].~T();
+    count--;
+}
+
+// move a growable array into one of new_capacity elements; 0 releases the array.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::reallocate(T*& values, size_type count, size_type& capacity, size_type new_capacity) {
+    assert(new_capacity >= count);
+    T* new_array = NULL;
+    if( new_capacity > 0 ) {
+        new_array = storage.allocate(new_capacity);
+        try {
+            transfer(values, values + count, new_array);
+        }
+        catch(...) {
+            storage.deallocate(new_array, new_capacity);
+            throw;
+        }
+    }
+    if( capacity > 0 ) {
+        destroy(values, values + count);
+        storage.deallocate(values, capacity);
+    }
+    values = new_array;
+    capacity = new_capacity;
+}
+
+// write a packed JaggedArray in the binary format described at JaggedArrayFileHeader.
+// Bins in the delta are written in place, as compact() would put them.
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::save(const char* filename) const {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only JaggedArrays of trivially copyable types can be saved");
+    if(counts != NULL) {    // unpacked mode
+        std::cerr << "save cannot be done to an unpacked JaggedArray; pack it first." << std::endl;
+        exit(1);
+    }
+    if(num_removed > 0) {
+        std::cerr << "save cannot be done with marked elements; compact it first." << std::endl;
+        exit(1);
+    }
+    std::ofstream ostr(filename, std::ios::binary | std::ios::trunc);
+    if(!ostr) {
+        std::cerr << "ERROR: cannot open file " << filename << " for writing" << std::endl;
+        exit(1);
+    }
+    JaggedArrayFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, JAGGED_FILE_MAGIC, sizeof(header.magic));
+    header.version = JAGGED_FILE_VERSION;
+    header.value_size = sizeof(T);
+    header.num_bins = num_bins;
+    header.num_elements = num_elements;
+    header.offsets_pos = sizeof(header);
+    uint64_t offsets_end = header.offsets_pos + (uint64_t(num_bins) + 1) * sizeof(uint64_t);
+    header.values_pos = (offsets_end + JAGGED_FILE_ALIGN - 1) / JAGGED_FILE_ALIGN * JAGGED_FILE_ALIGN;
+    header.byte_order = JAGGED_FILE_BYTE_ORDER;
+    ostr.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t offset = 0;
+    for(size_type b=0; b<=num_bins; b++) {
+        ostr.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        if(b < num_bins)
+            offset += numElementsInBin(b);
+    }
+    static const char padding[JAGGED_FILE_ALIGN] = { 0 };
+    ostr.write(padding, header.values_pos - offsets_end);
+    if(delta == NULL)
+        ostr.write(reinterpret_cast<const char*>(packed_values), uint64_t(num_elements) * sizeof(T));
+    else
+        for(size_type b=0; b<num_bins; b++)
+            ostr.write(reinterpret_cast<const char*>(bin_data(b)),
+                       uint64_t(numElementsInBin(b)) * sizeof(T));
+    if(!ostr) {
+        std::cerr << "ERROR: failed writing file " << filename << std::endl;
+        exit(1);
+    }
+}
+
+template<class T, class Storage, class Offsets>
+size_type JaggedArray<T, Storage, Offsets>::numElementsInBin(size_type bin) const {
     if(counts == NULL) {    // packed mode
         assert(bin < num_bins);
-        if(bin == num_bins-1)
-            return num_elements - offsets[bin];
-        else
-            return offsets[bin+1] - offsets[bin];
+        if(delta != NULL && delta[bin].values != NULL)
+            return delta[bin].count;
+        return offsets[bin+1] - offsets[bin];
     }
     else {  // unpacked mode
         return counts[bin];
     }
 }
 
-template<class T>
-const T& JaggedArray<T>::getElement(size_type bin, size_type i) const {
+template<class T, class Storage, class Offsets>
+const T& JaggedArray<T, Storage, Offsets>::getElement(size_type bin, size_type i) const {
+    return bin_data(bin)[i];
+}
+
+template<class T, class Storage, class Offsets>
+const T* JaggedArray<T, Storage, Offsets>::data() const {
+    if(counts != NULL || delta != NULL) {
+        std::cerr << "data needs a packed JaggedArray without a delta; pack or compact it first." << std::endl;
+        exit(1);
+    }
+    return packed_values;
+}
+
+template<class T, class Storage, class Offsets>
+void JaggedArray<T, Storage, Offsets>::const_iterator::find_bin() {
+    if(ja->counts != NULL) {    // unpacked mode
+        for(; b < ja->num_bins; b++)
+            if(ja->counts[b] > 0) {
+                cur = ja->unpacked_values[b];
+                last = cur + ja->counts[b];
+                return;
+            }
+    }
+    else {  // packed mode
+        for(; b < ja->num_bins; b++) {
+            size_type n = ja->numElementsInBin(b);
+            if(n > 0) {
+                cur = ja->bin_data(b);
+                last = cur + n;
+                return;
+            }
+        }
+    }
+    cur = last = NULL;
+}
+
+template<class T, class Storage, class Offsets>
+const T* JaggedArray<T, Storage, Offsets>::bin_data(size_type bin) const {
     if(counts == NULL) {    // packed mode
         assert(bin < num_bins);
-        return packed_values[ offsets[bin] + i ];
+        if(delta != NULL && delta[bin].values != NULL)
+            return delta[bin].values;
+        return packed_values + offsets[bin];
     }
     else {  // unpacked mode
-        return unpacked_values[bin][i];
+        return unpacked_values[bin];
     }
 }
 
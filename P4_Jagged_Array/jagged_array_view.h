@@ -0,0 +1,156 @@
+//
+//  jagged_array_view.h
+//
+//  A read-only JaggedArray served straight out of a memory mapped file
+//  written by JaggedArray::save(). Opening the file costs a few system calls
+//  and one pass over the offsets to check them; the values are read in by the
+//  OS page by page as bins are touched.
+//
+
+#ifndef jagged_array_view_h
+#define jagged_array_view_h
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "jagged_array.h"
+
+template <class T> class JaggedArrayView {
+public:
+    // CONSTRUCTORS & DESTRUCTOR
+    JaggedArrayView(const char* filename) { this->open(filename); }
+    JaggedArrayView(JaggedArrayView&& view) noexcept { steal(view); }
+    JaggedArrayView& operator=(JaggedArrayView&& view) noexcept {
+        if (this != &view) { close(); steal(view); }
+        return *this;
+    }
+    ~JaggedArrayView() { close(); }
+
+    // MEMBER FUNCTIONS - the same accessors as a packed JaggedArray
+    uint64_t numElements() const { return num_elements; }
+    size_type numBins() const { return num_bins; }
+    size_type numElementsInBin(size_type bin) const {
+        assert(bin < num_bins);
+        return offsets[bin+1] - offsets[bin];
+    }
+    const T& getElement(size_type bin, size_type i) const {
+        assert(bin < num_bins);
+        return values[ offsets[bin] + i ];
+    }
+    bool isPacked() const { return true; }
+    JaggedBin<T> bin(size_type b) const {
+        assert(b < num_bins);
+        return JaggedBin<T>(values + offsets[b], offsets[b+1] - offsets[b]);
+    }
+    const T* data() const { return values; }
+    // all elements, bin by bin; the file holds them as one array
+    const T* begin() const { return values; }
+    const T* end() const { return values + num_elements; }
+
+private:
+    // a mapping is owned by exactly one view
+    JaggedArrayView(const JaggedArrayView&);
+    JaggedArrayView& operator=(const JaggedArrayView&);
+
+    // PRIVATE MEMBER FUNCTIONS
+    void open(const char* filename);
+    void close();
+    void steal(JaggedArrayView<T>& view);
+
+    // REPRESENTATION
+    uint64_t num_elements;
+    size_type num_bins;
+    const uint64_t* offsets;    // num_bins+1 offsets inside the mapping
+    const T* values;            // num_elements values inside the mapping
+    void* mapping;              // the whole file, or NULL
+    size_t mapping_size;
+};
+
+template<class T>
+void JaggedArrayView<T>::open(const char* filename) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only JaggedArrays of trivially copyable types can be mapped");
+    int fd = ::open(filename, O_RDONLY);
+    if(fd < 0) {
+        std::cerr << "ERROR: cannot open file " << filename << std::endl;
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(JaggedArrayFileHeader)) {
+        std::cerr << "ERROR: " << filename << " is not a JaggedArray file" << std::endl;
+        exit(1);
+    }
+    mapping_size = st.st_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);    // the mapping keeps the file open
+    if(mapping == MAP_FAILED) {
+        std::cerr << "ERROR: cannot map file " << filename << std::endl;
+        exit(1);
+    }
+
+    // check the header before trusting any position in it
+    const char* base = static_cast<const char*>(mapping);
+    const JaggedArrayFileHeader& header = *reinterpret_cast<const JaggedArrayFileHeader*>(base);
+    if(std::memcmp(header.magic, JAGGED_FILE_MAGIC, sizeof(header.magic)) != 0
+       || header.version != JAGGED_FILE_VERSION
+       || header.byte_order != JAGGED_FILE_BYTE_ORDER) {
+        std::cerr << "ERROR: " << filename << " is not a JaggedArray file of this version" << std::endl;
+        exit(1);
+    }
+    if(header.value_size != sizeof(T)) {
+        std::cerr << "ERROR: " << filename << " holds values of " << header.value_size
+                  << " bytes, not " << sizeof(T) << std::endl;
+        exit(1);
+    }
+    // each position is checked against the mapping on its own, as a sum of them
+    // could wrap around
+    if(header.num_bins > size_type(-1)
+       || header.offsets_pos % sizeof(uint64_t) != 0 || header.values_pos % JAGGED_FILE_ALIGN != 0
+       || header.offsets_pos < sizeof(JaggedArrayFileHeader) || header.offsets_pos > mapping_size
+       || header.num_bins + 1 > (mapping_size - header.offsets_pos) / sizeof(uint64_t)
+       || header.values_pos < sizeof(JaggedArrayFileHeader) || header.values_pos > mapping_size
+       || header.num_elements > (mapping_size - header.values_pos) / sizeof(T)) {
+        std::cerr << "ERROR: " << filename << " is truncated or corrupt" << std::endl;
+        exit(1);
+    }
+    num_bins = header.num_bins;
+    num_elements = header.num_elements;
+    offsets = reinterpret_cast<const uint64_t*>(base + header.offsets_pos);
+    values = reinterpret_cast<const T*>(base + header.values_pos);
+    // every bin must lie inside the values, or bin() and getElement() would read
+    // past the mapping
+    bool ordered = offsets[0] == 0 && offsets[num_bins] == num_elements;
+    for(size_type b=0; ordered && b<num_bins; b++)
+        ordered = offsets[b] <= offsets[b+1];
+    if(!ordered) {
+        std::cerr << "ERROR: " << filename << " is truncated or corrupt" << std::endl;
+        exit(1);
+    }
+}
+
+template<class T>
+void JaggedArrayView<T>::close() {
+    if(mapping != NULL)
+        munmap(mapping, mapping_size);
+    mapping = NULL;
+    mapping_size = 0;
+    offsets = NULL;
+    values = NULL;
+    num_elements = num_bins = 0;
+}
+
+template<class T>
+void JaggedArrayView<T>::steal(JaggedArrayView<T>& view) {
+    num_elements = view.num_elements;
+    num_bins = view.num_bins;
+    offsets = view.offsets;
+    values = view.values;
+    mapping = view.mapping;
+    mapping_size = view.mapping_size;
+    view.mapping = NULL;
+    view.close();
+}
+
+#endif /* jagged_array_view_h */
@@ -3,8 +3,15 @@
 #include <string>
 #include <cstdlib>
 #include <cassert>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <thread>
 
 #include "jagged_array.h"
+#include "jagged_array_view.h"
+#include "concurrent_jagged_array.h"
 
 //
 // NOTE: YOUR FINAL SUBMITTED VERSION SHOULD ONLY CONTAIN 
@@ -443,6 +450,591 @@ void MyTests_str(){
     
 }
 
+// bins grow geometrically; reserve() and shrink_to_fit() must not disturb the contents
+void MyTests_capacity(){
+    JaggedArray<int> a(4);
+    for (int i = 0; i < 1000; i++)
+        a.addElement(2,i);
+    a.reserve(0,100);
+    assert (a.numElementsInBin(0) == 0);
+    a.addElement(0,-1);
+    for (int i = 0; i < 500; i++)
+        a.removeElement(2,0);
+    assert (a.numElements() == 501);
+    assert (a.numElementsInBin(2) == 500);
+    a.shrink_to_fit();
+    for (int i = 0; i < 500; i++)
+        assert (a.getElement(2,i) == i+500);
+    assert (a.getElement(0,0) == -1);
+    a.addElement(2,1000);
+    assert (a.getElement(2,500) == 1000);
+    a.pack();
+    assert (a.numElementsInBin(2) == 501);
+    a.unpack();
+    a.addElement(1,7);
+    assert (a.getElement(1,0) == 7);
+    a.clear();
+    assert (a.numElements() == 0);
+    a.addElement(3,8);
+    assert (a.getElement(3,0) == 8);
+    std::cout << "MyTests with bin capacity COMPLETED." << std::endl;
+}
+
+// a type with no default constructor, which JaggedArray must never need
+class NoDefault {
+public:
+    explicit NoDefault(int v) : value(v) {}
+    int get() const { return value; }
+private:
+    int value;
+};
+
+// pack()/unpack() and moves of the whole array relocate elements instead of copying them
+void MyTests_move(){
+    JaggedArray<std::string> a(4);
+    for (int i = 0; i < 20; i++)
+        a.addElement(i%4, std::string(100,'a'+i));
+    // a long string keeps its heap buffer when it is moved, so a moved element has the same data()
+    const char* p = a.getElement(3,4).data();
+    a.pack();
+    assert (a.getElement(3,4).data() == p);
+    a.unpack();
+    assert (a.getElement(3,4).data() == p);
+    a.removeElement(3,0);
+    assert (a.getElement(3,3).data() == p);
+
+    JaggedArray<std::string> b(std::move(a));
+    assert (b.numElements() == 19);
+    assert (b.getElement(3,3).data() == p);
+    JaggedArray<std::string> c(1);
+    c = std::move(b);
+    assert (c.numElementsInBin(3) == 4);
+    assert (c.getElement(3,3).data() == p);
+    assert (c.getElement(0,0) == std::string(100,'a'));
+    // moved-from arrays can still be assigned to
+    a = c;
+    assert (a.numElements() == 19);
+    assert (a.getElement(3,3) == c.getElement(3,3));
+
+    JaggedArray<NoDefault> d(3);
+    for (int i = 0; i < 10; i++)
+        d.addElement(i%3, NoDefault(i));
+    d.removeElement(1,1);
+    d.pack();
+    JaggedArray<NoDefault> e(d);
+    e.unpack();
+    assert (e.numElementsInBin(1) == 2);
+    assert (e.getElement(1,1).get() == 7);
+    assert (e.getElement(0,3).get() == 9);
+    std::cout << "MyTests with moves COMPLETED." << std::endl;
+}
+
+// a saved packed JaggedArray maps back with the same bins and elements
+void MyTests_file(){
+    const char* filename = "jagged_array_test.bin";
+    JaggedArray<double> a(6);
+    for (int i = 0; i < 50; i++)
+        a.addElement((i*i)%5, i/2.0);   // bin 5 stays empty
+    a.pack();
+    a.save(filename);
+    {
+        JaggedArrayView<double> v(filename);
+        assert (v.isPacked());
+        assert (v.numBins() == a.numBins());
+        assert (v.numElements() == a.numElements());
+        for (unsigned int i = 0; i < a.numBins(); i++) {
+            assert (v.numElementsInBin(i) == a.numElementsInBin(i));
+            for (unsigned int j = 0; j < a.numElementsInBin(i); j++)
+                assert (v.getElement(i,j) == a.getElement(i,j));
+        }
+        JaggedArrayView<double> w(std::move(v));
+        assert (w.numElementsInBin(5) == 0);
+        assert (w.getElement(4,0) == 1.0);
+        assert (w.bin(4)[0] == 1.0 && w.bin(5).empty());
+        assert (std::equal(w.begin(), w.end(), a.data()));
+    }
+    JaggedArray<double> empty(3);
+    empty.pack();
+    empty.save(filename);
+    JaggedArrayView<double> e(filename);
+    assert (e.numBins() == 3 && e.numElements() == 0);
+    std::remove(filename);
+    std::cout << "MyTests with files COMPLETED." << std::endl;
+}
+
+// a packed JaggedArray takes changes into its delta and compacts them away
+void MyTests_delta(){
+    JaggedArray<std::string> a(4);
+    for (int i = 0; i < 12; i++)
+        a.addElement(i%4, std::to_string(i));
+    a.pack();
+    a.setCompactThreshold(100);
+    a.addElement(1, "x");
+    a.addElement(1, a.getElement(1,0));     // an element of the bin being changed
+    a.removeElement(2, 0);
+    a.removeElement(3, 2);
+    assert (a.isPacked());
+    assert (a.numElements() == 12);
+    assert (a.numDeltaElements() == 4);     // two added, two removed
+    assert (a.numElementsInBin(0) == 3);
+    assert (a.numElementsInBin(1) == 5);
+    assert (a.getElement(1,3) == "x");
+    assert (a.getElement(1,4) == "1");
+    assert (a.getElement(2,0) == "6");
+    assert (a.numElementsInBin(3) == 2);
+    assert (a.getElement(3,1) == "7");
+    a.print();
+    // copies carry the delta
+    JaggedArray<std::string> b(a);
+    assert (b.numDeltaElements() == 4);
+    assert (b.getElement(1,4) == "1");
+    // compact() folds the delta into a fresh packed array
+    a.compact();
+    assert (a.numDeltaElements() == 0);
+    assert (a.numElements() == 12);
+    assert (a.getElement(1,3) == "x");
+    assert (a.getElement(3,1) == "7");
+    a.print();
+    // unpack() takes the delta bins over as they are
+    b.unpack();
+    assert (b.numElementsInBin(1) == 5);
+    assert (b.getElement(1,4) == "1");
+    assert (b.getElement(0,2) == "8");
+    // past the threshold the delta is compacted by itself
+    a.setCompactThreshold(0);
+    for (int i = 0; i < 100; i++)
+        a.addElement(0, "y");
+    assert (a.numDeltaElements() < 100);
+    assert (a.numElementsInBin(0) == 103);
+    assert (a.getElement(0,102) == "y");
+    // only the elements added count toward the threshold, not the ones of the bin
+    // moved into the delta with them, so appending to a large bin doesn't compact
+    // on every call
+    JaggedArray<int> c(2);
+    for (int i = 0; i < 10000; i++)
+        c.addElement(0, i);
+    c.pack();
+    for (int i = 0; i < 1000; i++)
+        c.addElement(0, i);
+    assert (c.numDeltaElements() == 1000);
+    assert (c.numElementsInBin(0) == 11000 && c.getElement(0,10999) == 999);
+    for (int i = 0; i < 300; i++)
+        c.addElement(0, i);
+    assert (c.numDeltaElements() < 1300);
+    assert (c.numElementsInBin(0) == 11300 && c.getElement(0,11299) == 299);
+    std::cout << "MyTests with delta COMPLETED." << std::endl;
+}
+
+// pack() and unpack() give the same result however many threads they use
+void MyTests_threads(){
+    JaggedArray<std::string> a(100);
+    for (int i = 0; i < 1000; i++)
+        a.addElement((i*7)%97, std::to_string(i));
+    JaggedArray<std::string> b(a);
+    a.pack();
+    b.pack(4);
+    for (unsigned int i = 0; i < a.numBins(); i++) {
+        assert (b.numElementsInBin(i) == a.numElementsInBin(i));
+        for (unsigned int j = 0; j < a.numElementsInBin(i); j++)
+            assert (b.getElement(i,j) == a.getElement(i,j));
+    }
+    b.removeElement(5,0);
+    b.unpack(3);
+    assert (b.numElements() == 999);
+    assert (b.getElement(5,0) == a.getElement(5,1));
+    JaggedArray<int> c(2);
+    c.addElement(1,1);
+    c.pack(8);      // more threads than bins
+    c.unpack(8);
+    assert (c.numElementsInBin(1) == 1);
+    std::cout << "MyTests with threads COMPLETED." << std::endl;
+}
+
+// JaggedArrays whose bins come from an ArenaStorage behave just like the default ones
+void MyTests_arena(){
+    typedef JaggedArray<std::string, ArenaStorage<std::string> > StringArena;
+    StringArena a(10);
+    for (int i = 0; i < 500; i++)
+        a.addElement(i%7, std::to_string(i));
+    a.removeElement(3, 0);
+    a.shrink_to_fit();
+    assert (a.numElements() == 499);
+    assert (a.numElementsInBin(3) == 70);
+    assert (a.getElement(3,0) == "10");
+    StringArena b(a);
+    a.pack();
+    a.addElement(8, "x");       // delta bins come from the arena too
+    a.removeElement(0, 0);
+    assert (a.numElementsInBin(8) == 1);
+    assert (a.getElement(0,0) == "7");
+    a.unpack(2);
+    assert (a.getElement(8,0) == "x");
+    a.clear();
+    assert (a.numElements() == 0);
+    a.addElement(1, "y");       // the arena is ready for more after a clear
+    assert (a.getElement(1,0) == "y");
+    StringArena c(std::move(b));
+    assert (c.numElements() == 499 && b.numElements() == 0);
+    b = c;
+    c.clear();
+    assert (b.getElement(6,70) == "496");
+    // a small slab, so the big bins get blocks of their own
+    JaggedArray<int, ArenaStorage<int, 256> > d(3);
+    for (int i = 0; i < 1000; i++)
+        d.addElement(i%3 == 0 ? 0 : 2, i);
+    d.removeElement(0, 0);
+    assert (d.numElementsInBin(0) == 333);
+    assert (d.getElement(2,665) == 998);
+    d.pack(2);
+    assert (d.getElement(0,0) == 3);
+    d.unpack();
+    d.clear();
+    d.addElement(2, 5);
+    assert (d.numElements() == 1);
+    std::cout << "MyTests with arena COMPLETED." << std::endl;
+}
+
+// bin() and the flat iterator see the same elements as getElement() in every mode
+void CheckIterators(const JaggedArray<std::string>& a) {
+    std::vector<std::string> flat;
+    for (unsigned int i = 0; i < a.numBins(); i++) {
+        JaggedBin<std::string> bin = a.bin(i);
+        assert (bin.size() == a.numElementsInBin(i));
+        for (unsigned int j = 0; j < bin.size(); j++)
+            assert (bin[j] == a.getElement(i,j));
+        flat.insert(flat.end(), bin.begin(), bin.end());
+    }
+    assert (std::distance(a.begin(), a.end()) == (long)a.numElements());
+    assert (std::equal(flat.begin(), flat.end(), a.begin()));
+}
+
+void MyTests_iterators(){
+    JaggedArray<std::string> a(8);
+    assert (a.begin() == a.end());
+    for (int i = 0; i < 40; i++)
+        a.addElement((i*3)%7, std::to_string(i));     // bin 7 stays empty
+    CheckIterators(a);
+    JaggedArray<std::string>::const_iterator it = a.begin();
+    assert (*it == "0" && it.binIndex() == 0);
+    std::advance(it, 6);
+    assert (it.binIndex() == 1 && *it == "5");
+    a.pack();
+    CheckIterators(a);
+    assert (std::equal(a.begin(), a.end(), a.data()));
+    a.addElement(7, "x");
+    a.removeElement(0, 0);
+    CheckIterators(a);
+    assert (std::find(a.begin(), a.end(), "x").binIndex() == 7);
+    a.unpack();
+    CheckIterators(a);
+    // std:: algorithms on a bin
+    JaggedArray<int> b(2);
+    for (int i = 1; i <= 10; i++)
+        b.addElement(1, i);
+    assert (std::accumulate(b.bin(1).begin(), b.bin(1).end(), 0) == 55);
+    assert (*std::max_element(b.begin(), b.end()) == 10);
+    std::cout << "MyTests with iterators COMPLETED." << std::endl;
+}
+
+// fromPairs() builds the same packed JaggedArray as addElement() and pack()
+void MyTests_fromPairs(){
+    std::vector<std::pair<unsigned int, std::string> > pairs;
+    JaggedArray<std::string> a(6);
+    for (int i = 0; i < 100; i++) {
+        pairs.push_back(std::make_pair((i*i)%5, std::to_string(i)));   // bin 5 stays empty
+        a.addElement((i*i)%5, std::to_string(i));
+    }
+    a.pack();
+    JaggedArray<std::string> b = JaggedArray<std::string>::fromPairs(pairs.begin(), pairs.end(), 6);
+    assert (b.isPacked());
+    assert (b.numElements() == 100);
+    assert (std::equal(a.data(), a.data() + a.numElements(), b.data()));
+    for (unsigned int i = 0; i < a.numBins(); i++)
+        assert (b.numElementsInBin(i) == a.numElementsInBin(i));
+    b.addElement(5, "x");       // an ordinary packed JaggedArray from here on
+    b.unpack();
+    assert (b.getElement(5,0) == "x");
+    // ints go through the threaded path
+    std::vector<std::pair<unsigned int, int> > edges;
+    JaggedArray<int> c(50);
+    for (int i = 0; i < 1000; i++) {
+        edges.push_back(std::make_pair((i*7)%49, i));
+        c.addElement((i*7)%49, i);
+    }
+    c.pack();
+    for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+        JaggedArray<int> d = JaggedArray<int>::fromPairs(edges.begin(), edges.end(), 50, threads);
+        assert (d.numElementsInBin(49) == 0);
+        for (unsigned int i = 0; i < c.numBins(); i++)
+            assert (d.numElementsInBin(i) == c.numElementsInBin(i));
+        assert (std::equal(c.data(), c.data() + c.numElements(), d.data()));
+    }
+    JaggedArray<int> e = JaggedArray<int>::fromPairs(edges.begin(), edges.begin(), 3, 4);
+    assert (e.numBins() == 3 && e.numElements() == 0 && e.isPacked());
+    std::cout << "MyTests with fromPairs COMPLETED." << std::endl;
+}
+
+// the same contents, whatever the encodings
+template <class JA, class REF>
+void CheckSame(const JA& a, const REF& ref) {
+    assert (a.numBins() == ref.numBins());
+    assert (a.numElements() == ref.numElements());
+    for (unsigned int i = 0; i < ref.numBins(); i++) {
+        assert (a.numElementsInBin(i) == ref.numElementsInBin(i));
+        for (unsigned int j = 0; j < ref.numElementsInBin(i); j++)
+            assert (a.getElement(i,j) == ref.getElement(i,j));
+    }
+}
+
+// packed JaggedArrays with 64 bit and compact offsets
+template <class Offsets>
+void TestOffsets(){
+    typedef JaggedArray<int, HeapStorage<int>, Offsets> JA;
+    // many small bins, with a big one that does not fit in 16 bit deltas
+    const unsigned int num_bins = 1000;
+    JA a(num_bins);
+    JaggedArray<int> ref(num_bins);
+    std::vector<std::pair<unsigned int, int> > pairs;
+    for (int i = 0; i < 3000; i++) {
+        unsigned int bin = (i*37)%num_bins;
+        a.addElement(bin, i);
+        ref.addElement(bin, i);
+        pairs.push_back(std::make_pair(bin, i));
+    }
+    for (int i = 0; i < 70000; i++) {
+        a.addElement(130, -i);
+        ref.addElement(130, -i);
+        pairs.push_back(std::make_pair(130u, -i));
+    }
+    a.pack(3);
+    ref.pack();
+    CheckSame(a, ref);
+    JA b(a);
+    CheckSame(b, ref);
+    a.addElement(999, 5);       // the delta and compact() rebuild the offsets
+    ref.addElement(999, 5);
+    a.removeElement(130, 0);
+    ref.removeElement(130, 0);
+    a.compact();
+    CheckSame(a, ref);
+    a.unpack(2);
+    ref.unpack();
+    CheckSame(a, ref);
+    JA c = JA::fromPairs(pairs.begin(), pairs.end(), num_bins);
+    JA d = JA::fromPairs(pairs.begin(), pairs.end(), num_bins, 4);
+    CheckSame(b, c);
+    CheckSame(b, d);
+    assert (c.offsetBytes() > 0 && a.offsetBytes() == 0);
+    JA e(0);
+    e.pack();
+    assert (e.numElements() == 0);
+}
+
+void MyTests_offsets(){
+    TestOffsets<Offsets64>();
+    TestOffsets<CompactOffsets>();
+    // small bins take a fraction of the space of 32 bit offsets
+    std::vector<std::pair<unsigned int, int> > pairs;
+    for (int i = 0; i < 100000; i++)
+        pairs.push_back(std::make_pair((unsigned int)i/2, i));
+    JaggedArray<int> a = JaggedArray<int>::fromPairs(pairs.begin(), pairs.end(), 50000);
+    JaggedArray<int, HeapStorage<int>, CompactOffsets> b =
+        JaggedArray<int, HeapStorage<int>, CompactOffsets>::fromPairs(pairs.begin(), pairs.end(), 50000);
+    assert (b.offsetBytes() * 10 < a.offsetBytes() * 6);
+    assert (b.getElement(49999,1) == 99999);
+    std::cout << "MyTests with offsets COMPLETED." << std::endl;
+}
+
+// swapRemove() and markRemoved()
+void MyTests_remove(){
+    JaggedArray<std::string> a(3);
+    for (int i = 0; i < 6; i++)
+        a.addElement(1, std::to_string(i));
+    a.swapRemove(1, 1);         // "5" takes the place of "1"
+    assert (a.numElementsInBin(1) == 5);
+    assert (a.getElement(1,1) == "5");
+    assert (a.getElement(1,4) == "4");
+    a.swapRemove(1, 4);         // the last one
+    assert (a.numElementsInBin(1) == 4 && a.numElements() == 4);
+    // marked elements keep their slots until pack()
+    a.markRemoved(1, 0);
+    a.markRemoved(1, 2);
+    a.markRemoved(1, 2);        // twice is once
+    assert (a.numRemoved() == 2);
+    assert (a.isRemoved(1,0) && !a.isRemoved(1,1) && a.isRemoved(1,2));
+    assert (a.numElementsInBin(1) == 4 && a.getElement(1,3) == "3");
+    a.addElement(1, "6");
+    a.removeElement(1, 1);      // marks move down with the elements
+    assert (a.isRemoved(1,0) && a.isRemoved(1,1) && !a.isRemoved(1,2));
+    a.swapRemove(1, 0);         // takes a mark away
+    assert (a.numRemoved() == 1 && !a.isRemoved(1,0) && a.getElement(1,0) == "6");
+    JaggedArray<std::string> b(a);
+    assert (b.numRemoved() == 1 && b.isRemoved(1,1));
+    a.pack();
+    assert (a.numRemoved() == 0);
+    assert (a.numElements() == 2 && a.numElementsInBin(1) == 2);
+    assert (a.getElement(1,0) == "6" && a.getElement(1,1) == "3");
+    // in packed mode marking needs no delta; compact() squeezes the marks out
+    a.addElement(0, "x");
+    a.addElement(2, "y");
+    a.compact();
+    a.setCompactThreshold(100);
+    a.markRemoved(0, 0);
+    assert (a.numDeltaElements() == 0);
+    a.swapRemove(1, 0);
+    assert (a.getElement(1,0) == "3");
+    a.compact();
+    assert (a.numRemoved() == 0 && a.numElements() == 2);
+    assert (a.numElementsInBin(0) == 0 && a.getElement(2,0) == "y");
+    // however many are marked, and even when the delta is folded by itself,
+    // no index changes until compact()
+    a.setCompactThreshold(0);
+    for (int i = 0; i < 200; i++)
+        a.addElement(0, std::to_string(i));
+    a.compact();
+    for (int i = 0; i < 200; i++)
+        a.markRemoved(0, i);
+    assert (a.numRemoved() == 200 && a.numElementsInBin(0) == 200);
+    for (int i = 0; i < 200; i++)
+        assert (a.isRemoved(0,i) && a.getElement(0,i) == std::to_string(i));
+    for (int i = 0; i < 100; i++)
+        a.addElement(1, "z");
+    assert (a.numDeltaElements() < 100);
+    assert (a.numRemoved() == 200 && a.numElementsInBin(0) == 200);
+    for (int i = 0; i < 200; i++)
+        assert (a.isRemoved(0,i) && a.getElement(0,i) == std::to_string(i));
+    a.compact();
+    assert (a.numRemoved() == 0 && a.numElementsInBin(0) == 0 && a.numElementsInBin(1) == 101);
+    for (int i = 0; i < 100; i++)
+        a.removeElement(1, 1);
+    a.compact();
+    // marks survive unpack()
+    a.markRemoved(2, 0);
+    a.unpack();
+    assert (a.isRemoved(2,0));
+    a.clear();
+    assert (a.numRemoved() == 0);
+    std::cout << "MyTests with remove COMPLETED." << std::endl;
+}
+
+// many threads adding to a ConcurrentJaggedArray at once, some of them to the same
+// bins and several bins to a lock, then freeze() into a packed JaggedArray
+void MyTests_concurrent(){
+    const int NUM_THREADS = 8;
+    const int PER_THREAD = 3000;
+    const size_type NUM_BINS = 37;
+    ConcurrentJaggedArray<std::string> c(NUM_BINS, 4);
+    for (int round = 0; round < 2; round++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++)
+            threads.push_back(std::thread([&c, t]() {
+                for (int i = 0; i < PER_THREAD; i++) {
+                    // every third element goes to bin 0, which all threads share
+                    size_type bin = i % 3 == 0 ? 0 : 1 + (i * 7 + t) % (NUM_BINS - 1);
+                    c.addElement(bin, std::to_string(t * PER_THREAD + i));
+                }
+            }));
+        for (int t = 0; t < NUM_THREADS; t++)
+            threads[t].join();
+        assert (c.numElementsInBin(0) == NUM_THREADS * PER_THREAD / 3);
+        JaggedArray<std::string> a = c.freeze(round == 0 ? 1 : 3);
+        assert (a.isPacked());
+        assert (a.numElements() == NUM_THREADS * PER_THREAD);
+        // each element is there once, in its bin, and each thread's elements of a
+        // bin are in the order that thread added them
+        std::vector<int> seen(NUM_THREADS * PER_THREAD, 0);
+        for (size_type b = 0; b < NUM_BINS; b++) {
+            std::vector<int> last(NUM_THREADS, -1);
+            for (size_type j = 0; j < a.numElementsInBin(b); j++) {
+                int v = atoi(a.getElement(b,j).c_str());
+                int t = v / PER_THREAD, i = v % PER_THREAD;
+                assert (b == (i % 3 == 0 ? 0 : 1 + (i * 7 + t) % (NUM_BINS - 1)));
+                assert (i > last[t]);
+                last[t] = i;
+                seen[v]++;
+            }
+        }
+        for (size_t v = 0; v < seen.size(); v++)
+            assert (seen[v] == 1);
+        // freeze() leaves it empty, to be filled again
+        for (size_type b = 0; b < NUM_BINS; b++)
+            assert (c.numElementsInBin(b) == 0);
+    }
+    std::cout << "MyTests with concurrent COMPLETED." << std::endl;
+}
+
+// the values of two sorted vectors in both / in either, each once
+std::vector<int> SetOp(const std::vector<int>& x, const std::vector<int>& y, bool intersect) {
+    std::vector<int> out;
+    if (intersect)
+        std::set_intersection(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(out));
+    else
+        std::set_union(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(out));
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+// packSorted() and what it allows
+void MyTests_sorted(){
+    JaggedArray<std::string> a(3);
+    const char* words[] = { "pear", "fig", "apple", "kiwi", "fig", "date" };
+    for (int i = 0; i < 6; i++)
+        a.addElement(1, words[i]);
+    a.addElement(2, "fig");
+    a.addElement(2, "plum");
+    assert (!a.isSorted());
+    a.packSorted();
+    assert (a.isSorted());
+    assert (a.getElement(1,0) == "apple" && a.getElement(1,5) == "pear");
+    assert (a.contains(1, "kiwi") && !a.contains(1, "lime") && !a.contains(0, "fig"));
+    assert (a.lowerBound(1, "fig") == 2 && a.lowerBound(1, "zucchini") == 6);
+    std::vector<std::string> both, either;
+    a.intersectBins(1, 2, std::back_inserter(both));
+    a.unionBins(1, 2, std::back_inserter(either));
+    assert (both.size() == 1 && both[0] == "fig");
+    assert (either.size() == 6 && either[5] == "plum");
+    // the bins stay sorted, marks moving along with their elements
+    a.setCompactThreshold(100);
+    a.markRemoved(1, 4);        // "kiwi"
+    a.addElement(1, "banana");
+    assert (a.getElement(1,1) == "banana" && a.isRemoved(1,5) && a.getElement(1,5) == "kiwi");
+    a.swapRemove(1, 0);
+    assert (a.getElement(1,0) == "banana" && a.lowerBound(1, "date") == 1);
+    JaggedArray<std::string> b(a);
+    a.compact();
+    assert (a.isSorted() && a.numElementsInBin(1) == 5 && a.getElement(1,3) == "fig");
+    assert (b.isSorted() && b.isRemoved(1,4));
+    a.unpack();
+    assert (!a.isSorted());
+    // intersections, SSE2 for ints, and unions against the standard algorithms
+    unsigned long long state = 7;
+    for (int round = 0; round < 200; round++) {
+        JaggedArray<int> c(2);
+        for (int b = 0; b < 2; b++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            int n = (int)(state >> 33) % 40, range = 1 + (int)(state >> 40) % 60;
+            for (int i = 0; i < n; i++) {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                c.addElement(b, (int)(state >> 33) % range - range / 2);
+            }
+        }
+        c.packSorted(2);
+        std::vector<int> x(c.bin(0).begin(), c.bin(0).end()), y(c.bin(1).begin(), c.bin(1).end());
+        std::vector<int> out;
+        c.intersectBins(0, 1, std::back_inserter(out));
+        assert (out == SetOp(x, y, true));
+        out.clear();
+        c.intersectBins(1, 0, std::back_inserter(out));
+        assert (out == SetOp(x, y, true));
+        out.clear();
+        c.unionBins(0, 1, std::back_inserter(out));
+        assert (out == SetOp(x, y, false));
+        for (int v = -31; v <= 31; v++)
+            assert (c.contains(0, v) == std::binary_search(x.begin(), x.end(), v));
+    }
+    std::cout << "MyTests with sorted COMPLETED." << std::endl;
+}
+
 //
 // NOTE: ADD YOUR OWN TESTS TO THIS FUNCTION
 //
@@ -454,6 +1046,18 @@ void StudentTests() {
   //   
     MyTests_int();
     MyTests_str();
+    MyTests_capacity();
+    MyTests_move();
+    MyTests_file();
+    MyTests_delta();
+    MyTests_threads();
+    MyTests_arena();
+    MyTests_iterators();
+    MyTests_fromPairs();
+    MyTests_offsets();
+    MyTests_remove();
+    MyTests_concurrent();
+    MyTests_sorted();
 }
 
 
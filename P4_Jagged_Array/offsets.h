@@ -0,0 +1,199 @@
+//
+//  offsets.h
+//
+//  Encodings for the offsets of a packed JaggedArray: entry b is where bin b
+//  starts in packed_values[], entry num_bins is num_elements. An encoding has
+//
+//    typedef ... offset_type;                  wide enough for num_elements
+//    void adopt(offset_type* plain, size_t num_bins);
+//                                              take over plain[0..num_bins], allocated
+//                                              with new[]; deleted even if this throws
+//    offset_type operator[](size_t b) const;   entry b, in O(1)
+//    bool empty() const;                       no table, as when unpacked
+//    void clear();
+//    void swap(Offsets& o);
+//    size_t bytes() const;                     memory used by the table
+//
+//  and can be copied.
+//
+
+#ifndef offsets_h
+#define offsets_h
+
+#include <cstddef>
+#include <stdint.h>
+#include <utility>
+#include <algorithm>
+
+// a plain array of OffsetT: Offsets32 (the default) holds up to 4G elements,
+// Offsets64 as many as fit in memory
+template <class OffsetT> class PlainOffsets {
+public:
+    typedef OffsetT offset_type;
+
+    PlainOffsets() : n(0), entries(NULL) {}
+    PlainOffsets(const PlainOffsets& o);
+    PlainOffsets& operator=(const PlainOffsets& o) {
+        if (this != &o) { PlainOffsets tmp(o); swap(tmp); }
+        return *this;
+    }
+    ~PlainOffsets() { clear(); }
+
+    void adopt(offset_type* plain, size_t num_bins) {
+        clear();
+        entries = plain;
+        n = num_bins;
+    }
+    offset_type operator[](size_t b) const { return entries[b]; }
+    bool empty() const { return entries == NULL; }
+    void clear() { delete [] entries; entries = NULL; n = 0; }
+    void swap(PlainOffsets& o) {
+        std::swap(n, o.n);
+        std::swap(entries, o.entries);
+    }
+    size_t bytes() const { return empty() ? 0 : (n + 1) * sizeof(offset_type); }
+
+private:
+    size_t n;                   // number of bins; entries holds n+1 offsets
+    offset_type* entries;
+};
+
+typedef PlainOffsets<unsigned int> Offsets32;
+typedef PlainOffsets<uint64_t> Offsets64;
+
+template<class OffsetT>
+PlainOffsets<OffsetT>::PlainOffsets(const PlainOffsets& o) : n(0), entries(NULL) {
+    if(o.entries == NULL)
+        return;
+    entries = new offset_type[o.n + 1];
+    for(size_t b=0; b<=o.n; b++)
+        entries[b] = o.entries[b];
+    n = o.n;
+}
+
+// For many small bins. The offsets are cut into blocks of BLOCK entries. A block
+// keeps its first offset in 64 bits and every entry as a 16 bit difference from
+// it, about 2.25 bytes a bin. A block whose bins hold more than 65535 elements
+// between them keeps its entries in 64 bits instead.
+class CompactOffsets {
+public:
+    typedef uint64_t offset_type;
+
+    CompactOffsets() : n(0), blocks(NULL), deltas(NULL), wide(NULL), num_wide(0) {}
+    CompactOffsets(const CompactOffsets& o);
+    CompactOffsets& operator=(const CompactOffsets& o) {
+        if (this != &o) { CompactOffsets tmp(o); swap(tmp); }
+        return *this;
+    }
+    ~CompactOffsets() { clear(); }
+
+    void adopt(offset_type* plain, size_t num_bins);
+    offset_type operator[](size_t b) const {
+        const Block& block = blocks[b / BLOCK];
+        if(block.wide == NARROW)
+            return block.base + deltas[b];
+        return wide[block.wide + b % BLOCK];
+    }
+    bool empty() const { return blocks == NULL; }
+    void clear();
+    void swap(CompactOffsets& o) {
+        std::swap(n, o.n);
+        std::swap(blocks, o.blocks);
+        std::swap(deltas, o.deltas);
+        std::swap(wide, o.wide);
+        std::swap(num_wide, o.num_wide);
+    }
+    size_t bytes() const {
+        if(empty())
+            return 0;
+        return num_blocks() * sizeof(Block) + (n + 1) * sizeof(uint16_t)
+               + num_wide * BLOCK * sizeof(offset_type);
+    }
+
+private:
+    static const size_t BLOCK = 64;
+    static const size_t NARROW = size_t(-1);
+    struct Block {
+        offset_type base;       // the first offset of the block
+        size_t wide;            // NARROW, or where the block's entries start in wide[]
+    };
+    size_t num_blocks() const { return n / BLOCK + 1; }
+
+    // REPRESENTATION
+    size_t n;                   // number of bins; there are n+1 entries
+    Block* blocks;
+    uint16_t* deltas;           // entry b - its block's base, for narrow blocks
+    offset_type* wide;          // BLOCK entries for each wide block
+    size_t num_wide;            // number of wide blocks
+};
+
+inline void CompactOffsets::adopt(offset_type* plain, size_t num_bins) {
+    clear();
+    size_t num_entries = num_bins + 1;
+    size_t nblocks = num_bins / BLOCK + 1;
+    size_t wide_blocks = 0;
+    for(size_t k=0; k<nblocks; k++) {
+        size_t last = (k + 1) * BLOCK < num_entries ? (k + 1) * BLOCK : num_entries;
+        if(plain[last-1] - plain[k*BLOCK] > 0xFFFF)
+            wide_blocks++;
+    }
+    try {
+        blocks = new Block[nblocks];
+        deltas = new uint16_t[num_entries];
+        wide = new offset_type[wide_blocks * BLOCK];
+    }
+    catch(...) {
+        delete [] blocks; blocks = NULL;
+        delete [] deltas; deltas = NULL;
+        delete [] plain;
+        throw;
+    }
+    num_wide = 0;
+    for(size_t k=0; k<nblocks; k++) {
+        size_t first = k * BLOCK;
+        size_t last = first + BLOCK < num_entries ? first + BLOCK : num_entries;
+        blocks[k].base = plain[first];
+        if(plain[last-1] - plain[first] > 0xFFFF) {
+            blocks[k].wide = num_wide * BLOCK;
+            for(size_t b=first; b<last; b++)
+                wide[blocks[k].wide + b - first] = plain[b];
+            num_wide++;
+        }
+        else {
+            blocks[k].wide = NARROW;
+            for(size_t b=first; b<last; b++)
+                deltas[b] = uint16_t(plain[b] - plain[first]);
+        }
+    }
+    n = num_bins;
+    delete [] plain;
+}
+
+inline CompactOffsets::CompactOffsets(const CompactOffsets& o)
+    : n(0), blocks(NULL), deltas(NULL), wide(NULL), num_wide(0) {
+    if(o.empty())
+        return;
+    try {
+        blocks = new Block[o.num_blocks()];
+        deltas = new uint16_t[o.n + 1];
+        wide = new offset_type[o.num_wide * BLOCK];
+    }
+    catch(...) {
+        clear();
+        throw;
+    }
+    std::copy(o.blocks, o.blocks + o.num_blocks(), blocks);
+    std::copy(o.deltas, o.deltas + o.n + 1, deltas);
+    std::copy(o.wide, o.wide + o.num_wide * BLOCK, wide);
+    n = o.n;
+    num_wide = o.num_wide;
+}
+
+inline void CompactOffsets::clear() {
+    delete [] blocks; blocks = NULL;
+    delete [] deltas; deltas = NULL;
+    delete [] wide; wide = NULL;
+    n = num_wide = 0;
+}
+
+#endif /* offsets_h */
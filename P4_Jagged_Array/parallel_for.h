@@ -0,0 +1,62 @@
+//
+//  parallel_for.h
+//
+//  Runs a loop body over [0, n) split into contiguous ranges, one per thread.
+//
+
+#ifndef parallel_for_h
+#define parallel_for_h
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// the first index of range t when [0, n) is split into num_ranges near-equal ranges
+inline size_t range_begin(size_t n, unsigned int num_ranges, unsigned int t) {
+    size_t extra = n % num_ranges;
+    return n / num_ranges * t + (t < extra ? t : extra);
+}
+
+// Split [0, n) into num_threads contiguous ranges and call f(t, begin, end) for each
+// range t: range 0 on the calling thread, the others on threads of their own.
+// Returns once all of them are done. If any f throws, the exception of the lowest
+// numbered range is rethrown after that, so f should leave behind whatever the caller
+// needs to clean up after a range that did not complete.
+template<class F>
+void parallel_for(unsigned int num_threads, size_t n, F f) {
+    if(num_threads > n)
+        num_threads = n;
+    if(num_threads <= 1) {
+        f(0u, size_t(0), n);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    try {
+        for(unsigned int t=1; t<num_threads; t++) {
+            size_t begin = range_begin(n, num_threads, t);
+            size_t end = range_begin(n, num_threads, t + 1);
+            threads.push_back(std::thread([&f, &errors, t, begin, end]() {
+                try { f(t, begin, end); }
+                catch(...) { errors[t] = std::current_exception(); }
+            }));
+        }
+    }
+    catch(...) {
+        // could not start a thread: let the started ones finish before giving up
+        for(unsigned int t=0; t<threads.size(); t++)
+            threads[t].join();
+        throw;
+    }
+    try { f(0u, size_t(0), range_begin(n, num_threads, 1)); }
+    catch(...) { errors[0] = std::current_exception(); }
+    for(unsigned int t=0; t<threads.size(); t++)
+        threads[t].join();
+    for(unsigned int t=0; t<num_threads; t++)
+        if(errors[t])
+            std::rethrow_exception(errors[t]);
+}
+
+#endif /* parallel_for_h */
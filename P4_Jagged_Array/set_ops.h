@@ -0,0 +1,114 @@
+//
+//  set_ops.h
+//
+//  Intersection and union of two sorted arrays, as for the bins of a JaggedArray
+//  packed with packSorted(). Both treat the arrays as sets: a value that is in them
+//  more than once is written once, and the values come out in order.
+//
+
+#ifndef set_ops_h
+#define set_ops_h
+
+#include <cstddef>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// write *v to out unless it is the value written last, which is no greater
+template<class T, class OutIt>
+inline void emit_once(const T* v, const T*& last, OutIt& out) {
+    if(last == NULL || *last < *v) {
+        *out++ = *v;
+        last = v;
+    }
+}
+
+// the merge of a[i..na) and b[j..nb) that intersect_sorted() falls back to and
+// finishes with; last is the value written last, or NULL
+template<class T, class OutIt>
+OutIt intersect_sorted_scalar(const T* a, size_t na, const T* b, size_t nb, OutIt out,
+                              size_t i = 0, size_t j = 0, const T* last = NULL) {
+    while(i < na && j < nb) {
+        if(a[i] < b[j])
+            i++;
+        else if(b[j] < a[i])
+            j++;
+        else {
+            emit_once(a + i, last, out);
+            i++;
+            j++;
+        }
+    }
+    return out;
+}
+
+template<class T, class OutIt>
+OutIt intersect_sorted_simd(const T* a, size_t na, const T* b, size_t nb, OutIt out, std::false_type) {
+    return intersect_sorted_scalar(a, na, b, nb, out);
+}
+
+// 32 bit integers with SSE2: a block of 4 values of a is compared with a block of 4
+// of b in all 4 rotations at once, and the block with the smaller last value moves
+// on, or both when those are equal. Any value in a block of a that equals a value
+// of b meets it in one of the block pairs compared, and since matches come out in
+// order a value met again is dropped by emit_once(). The last few values go through
+// the scalar merge.
+template<class T, class OutIt>
+OutIt intersect_sorted_simd(const T* a, size_t na, const T* b, size_t nb, OutIt out, std::true_type) {
+    size_t i = 0, j = 0;
+    const T* last = NULL;
+#if defined(__SSE2__)
+    while(i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0,3,2,1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1,0,3,2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2,1,0,3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        for(int k=0; mask != 0; k++, mask >>= 1)
+            if(mask & 1)
+                emit_once(a + i + k, last, out);
+        T amax = a[i+3], bmax = b[j+3];
+        if(!(bmax < amax))
+            i += 4;
+        if(!(amax < bmax))
+            j += 4;
+    }
+#endif
+    return intersect_sorted_scalar(a, na, b, nb, out, i, j, last);
+}
+
+// the values in both a[0..na) and b[0..nb)
+template<class T, class OutIt>
+OutIt intersect_sorted(const T* a, size_t na, const T* b, size_t nb, OutIt out) {
+    typedef std::integral_constant<bool, std::is_integral<T>::value && sizeof(T) == 4> simd;
+    return intersect_sorted_simd(a, na, b, nb, out, simd());
+}
+
+// the values in either a[0..na) or b[0..nb). This stays a scalar merge: every value
+// is compared and written on its own anyway, and SSE2 has no 32 bit min/max for a
+// merge network.
+template<class T, class OutIt>
+OutIt union_sorted(const T* a, size_t na, const T* b, size_t nb, OutIt out) {
+    size_t i = 0, j = 0;
+    const T* last = NULL;
+    while(i < na && j < nb) {
+        if(b[j] < a[i])
+            emit_once(b + j++, last, out);
+        else {
+            if(!(a[i] < b[j]))
+                j++;
+            emit_once(a + i++, last, out);
+        }
+    }
+    for(; i < na; i++)
+        emit_once(a + i, last, out);
+    for(; j < nb; j++)
+        emit_once(b + j, last, out);
+    return out;
+}
+
+#endif /* set_ops_h */
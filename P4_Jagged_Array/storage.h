@@ -0,0 +1,172 @@
+//
+//  storage.h
+//
+//  Storage policies for the arrays that hold the bins of an unpacked JaggedArray
+//  (and the delta of a packed one). A policy hands out uninitialized arrays of T:
+//
+//    T* allocate(size_t n);             an array with room for n elements, n > 0
+//    void deallocate(T* p, size_t n);   give back p, which was allocated with n
+//    void release_all();                when releases_all, give back every array at once
+//    void swap(Storage& s);
+//    static const bool releases_all;    release_all() frees every array handed out
+//    static const bool concurrent;      allocate/deallocate may run on several threads at once
+//
+
+#ifndef storage_h
+#define storage_h
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// every array is its own allocation from the global operator new
+template <class T> class HeapStorage {
+public:
+    static const bool releases_all = false;
+    static const bool concurrent = true;
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { ::operator delete(p); }
+    void release_all() {}
+    void swap(HeapStorage&) {}
+};
+
+// Arrays are carved out of slabs of SLAB_BYTES. Each request is rounded up to a
+// power-of-two number of elements, its size class, and a given back array goes on
+// the free list of its class for the next request of that class. Arrays too big to
+// share a slab get an allocation of their own. Giving back everything - when a
+// JaggedArray is cleared, packed or destroyed - costs one free per slab.
+template <class T, size_t SLAB_BYTES = (size_t(1) << 20)> class ArenaStorage {
+public:
+    static const bool releases_all = true;
+    static const bool concurrent = false;
+
+    ArenaStorage() : slabs(NULL), large(NULL), next(NULL), end(NULL) {
+        for(int c=0; c<NUM_CLASSES; c++)
+            free_lists[c] = NULL;
+    }
+    ~ArenaStorage() { release_all(); }
+
+    T* allocate(size_t n);
+    void deallocate(T* p, size_t n);
+    void release_all();
+    void swap(ArenaStorage& s);
+
+private:
+    // an arena owns its slabs, so it cannot be copied
+    ArenaStorage(const ArenaStorage&);
+    ArenaStorage& operator=(const ArenaStorage&);
+
+    // every block is aligned for T and for holding a FreeBlock while on a free list
+    static const size_t ALIGN = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    // slabs and large blocks start with a header, padded so the blocks after it stay aligned
+    static const size_t HEADER = (2 * sizeof(void*) + ALIGN - 1) / ALIGN * ALIGN;
+    static const int NUM_CLASSES = 8 * sizeof(size_t);
+
+    struct FreeBlock { FreeBlock* next; };
+    struct Slab { Slab* next; };
+    struct LargeBlock { LargeBlock* prev; LargeBlock* next; };
+
+    // size class c holds arrays of 2^c elements
+    static int size_class(size_t n) {
+        int c = 0;
+        while((size_t(1) << c) < n)
+            c++;
+        return c;
+    }
+    static size_t block_bytes(int c) {
+        size_t bytes = sizeof(T) << c;
+        if(bytes < sizeof(FreeBlock))
+            bytes = sizeof(FreeBlock);
+        return (bytes + ALIGN - 1) / ALIGN * ALIGN;
+    }
+    static bool is_large(size_t bytes) { return bytes > (SLAB_BYTES - HEADER) / 4; }
+
+    // REPRESENTATION
+    Slab* slabs;                        // all slabs, newest first
+    LargeBlock* large;                  // arrays with an allocation of their own
+    char* next;                         // unused part of the newest slab
+    char* end;
+    FreeBlock* free_lists[NUM_CLASSES]; // given back arrays of each size class
+};
+
+template<class T, size_t SLAB_BYTES>
+T* ArenaStorage<T, SLAB_BYTES>::allocate(size_t n) {
+    int c = size_class(n);
+    size_t bytes = block_bytes(c);
+    if(is_large(bytes)) {
+        char* raw = static_cast<char*>(::operator new(HEADER + bytes));
+        LargeBlock* block = reinterpret_cast<LargeBlock*>(raw);
+        block->prev = NULL;
+        block->next = large;
+        if(large != NULL)
+            large->prev = block;
+        large = block;
+        return reinterpret_cast<T*>(raw + HEADER);
+    }
+    if(free_lists[c] != NULL) {
+        FreeBlock* block = free_lists[c];
+        free_lists[c] = block->next;
+        return reinterpret_cast<T*>(block);
+    }
+    if(next == NULL || size_t(end - next) < bytes) {
+        // start a new slab; whatever is left of the old one goes unused
+        char* raw = static_cast<char*>(::operator new(SLAB_BYTES));
+        Slab* slab = reinterpret_cast<Slab*>(raw);
+        slab->next = slabs;
+        slabs = slab;
+        next = raw + HEADER;
+        end = raw + SLAB_BYTES;
+    }
+    T* p = reinterpret_cast<T*>(next);
+    next += bytes;
+    return p;
+}
+
+template<class T, size_t SLAB_BYTES>
+void ArenaStorage<T, SLAB_BYTES>::deallocate(T* p, size_t n) {
+    int c = size_class(n);
+    if(is_large(block_bytes(c))) {
+        LargeBlock* block = reinterpret_cast<LargeBlock*>(reinterpret_cast<char*>(p) - HEADER);
+        if(block->prev != NULL)
+            block->prev->next = block->next;
+        else
+            large = block->next;
+        if(block->next != NULL)
+            block->next->prev = block->prev;
+        ::operator delete(block);
+        return;
+    }
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+    block->next = free_lists[c];
+    free_lists[c] = block;
+}
+
+template<class T, size_t SLAB_BYTES>
+void ArenaStorage<T, SLAB_BYTES>::release_all() {
+    while(slabs != NULL) {
+        Slab* slab = slabs;
+        slabs = slab->next;
+        ::operator delete(slab);
+    }
+    while(large != NULL) {
+        LargeBlock* block = large;
+        large = block->next;
+        ::operator delete(block);
+    }
+    next = end = NULL;
+    for(int c=0; c<NUM_CLASSES; c++)
+        free_lists[c] = NULL;
+}
+
+template<class T, size_t SLAB_BYTES>
+void ArenaStorage<T, SLAB_BYTES>::swap(ArenaStorage& s) {
+    std::swap(slabs, s.slabs);
+    std::swap(large, s.large);
+    std::swap(next, s.next);
+    std::swap(end, s.end);
+    for(int c=0; c<NUM_CLASSES; c++)
+        std::swap(free_lists[c], s.free_lists[c]);
+}
+
+#endif /* storage_h */
@@ -0,0 +1,207 @@
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "graph.h"
+#include "batch.h"
+
+// A puzzle read in, not solved yet
+struct BatchPuzzle {
+    unsigned long index;        // in the stream, from 0
+    std::string name;
+    std::vector<int> islands;   // x, y and n of each
+    std::string error;          // why it couldn't be read, or empty
+};
+
+// What the reading thread and the solving threads share
+struct Batch {
+    std::mutex lock;                        // of all the rest
+    std::condition_variable changed;        // of waiting or done_reading
+    std::deque<BatchPuzzle> waiting;        // read and not taken yet
+    unsigned int max_waiting;
+    bool done_reading;
+    std::map<unsigned long, std::string> finished;  // lines not written yet
+    unsigned long written;                  // lines written, so the next one's index
+    std::ostream *out;
+    std::map<std::string, unsigned long> statuses;  // how many puzzles got each
+};
+
+// Read the islands of a puzzle from lines of in, up to a blank line or the end.
+// False if there were none.
+static bool read_islands(std::istream &in, BatchPuzzle &puzzle) {
+    std::string line;
+    bool any = false;
+    while( std::getline(in, line) ) {
+        if( line.find_first_not_of(" \t\r") == std::string::npos ) {
+            if( any )
+                break;
+            continue;
+        }
+        if( line[0] == '#' ) {
+            size_t name = line.find_first_not_of("# \t\r");
+            if( !any && name != std::string::npos )
+                puzzle.name = line.substr(name, line.find_last_not_of(" \t\r") + 1 - name);
+            continue;
+        }
+        any = true;
+        std::istringstream fields(line);
+        int x, y, n;
+        if( !(fields >> x >> y >> n) || x < 0 || y < 0 || n < 1 || n > 8 ) {
+            if( puzzle.error.empty() )
+                puzzle.error = "bad island '" + line + "'";
+            continue;
+        }
+        puzzle.islands.push_back(x);
+        puzzle.islands.push_back(y);
+        puzzle.islands.push_back(n);
+    }
+    return any;
+}
+
+// Read the next puzzle of the stream. False at its end.
+static bool read_puzzle(std::istream &in, bool list, BatchPuzzle &puzzle) {
+    if( !list ) {
+        bool any = read_islands(in, puzzle);
+        if( puzzle.name.empty() ) {
+            std::ostringstream name;
+            name << puzzle.index + 1;
+            puzzle.name = name.str();
+        }
+        return any;
+    }
+    std::string path;
+    while( std::getline(in, path) ) {
+        path.erase(path.find_last_not_of(" \t\r") + 1);
+        if( path.empty() )
+            continue;
+        std::ifstream file(path.c_str());
+        if( !file.good() )
+            puzzle.error = "could not open file";
+        else
+            read_islands(file, puzzle);
+        puzzle.name = path;
+        return true;
+    }
+    return false;
+}
+
+// Solve puzzle, and make its line of output
+static std::string solve_puzzle(const BatchPuzzle &puzzle, const HashiOptions &options,
+                                std::string &status) {
+    std::ostringstream line;
+    line << puzzle.name << '\t';
+    std::string error = puzzle.error;
+    if( error.empty() && puzzle.islands.empty() )
+        error = "no islands";
+    if( !error.empty() ) {
+        status = "error";
+        line << status << "\t0\t0\t" << error;
+        return line.str();
+    }
+
+    Graph g;
+    for( unsigned int i = 0; i < puzzle.islands.size(); i += 3 )
+        g.addNode(Point(puzzle.islands[i], puzzle.islands[i+1]), puzzle.islands[i+2]);
+    g.hashi(options);
+    const HashiStats &stats = g.get_stats();
+    status = stats.timed_out ? "timeout" : stats.solutions > 0 ? "solved" : "unsolvable";
+    line << status << '\t' << stats.solutions << '\t' << stats.seconds << '\t';
+
+    // the solution has an Edge for each bridge, either way round
+    std::map<std::pair<std::pair<int, int>, std::pair<int, int> >, unsigned int> bridges;
+    const std::vector<Edge> &edges = g.get_edges();
+    for( unsigned int i = 0; i < edges.size(); i++ ) {
+        std::pair<int, int> a(edges[i].get_a().get_x(), edges[i].get_a().get_y());
+        std::pair<int, int> b(edges[i].get_b().get_x(), edges[i].get_b().get_y());
+        bridges[std::make_pair(std::min(a, b), std::max(a, b))]++;
+    }
+    std::map<std::pair<std::pair<int, int>, std::pair<int, int> >, unsigned int>::const_iterator b;
+    for( b = bridges.begin(); b != bridges.end(); ++b )
+        line << (b == bridges.begin() ? "" : " ") << b->first.first.first << ','
+             << b->first.first.second << ',' << b->first.second.first << ','
+             << b->first.second.second << ',' << b->second;
+    return line.str();
+}
+
+// Solve puzzles until there are none left, writing each line once those before it are
+static void solve_puzzles(Batch &batch, const HashiOptions &options) {
+    while( true ) {
+        BatchPuzzle puzzle;
+        {
+            std::unique_lock<std::mutex> guard(batch.lock);
+            batch.changed.wait(guard, [&]() { return !batch.waiting.empty() || batch.done_reading; });
+            if( batch.waiting.empty() )
+                return;
+            std::swap(puzzle, batch.waiting.front());
+            batch.waiting.pop_front();
+        }
+        batch.changed.notify_all();
+
+        std::string status;
+        std::string line = solve_puzzle(puzzle, options, status);
+        std::lock_guard<std::mutex> guard(batch.lock);
+        batch.statuses[status]++;
+        batch.finished[puzzle.index].swap(line);
+        while( !batch.finished.empty() && batch.finished.begin()->first == batch.written ) {
+            *batch.out << batch.finished.begin()->second << '\n';
+            batch.finished.erase(batch.finished.begin());
+            batch.written++;
+        }
+    }
+}
+
+void solve_batch(std::istream &in, bool list, const HashiOptions &options, std::ostream &out) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int num_threads = options.threads;
+    if( num_threads == 0 )
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    // each puzzle on one thread, printing nothing itself
+    std::ostream null(NULL);
+    HashiOptions solve = options;
+    solve.threads = 1;
+    solve.verbosity = HashiOptions::QUIET;
+    solve.print_solutions = false;
+    solve.out = &null;
+
+    Batch batch;
+    batch.max_waiting = 4 * num_threads;
+    batch.done_reading = false;
+    batch.written = 0;
+    batch.out = &out;
+    out << "# name\tstatus\tsolutions\tseconds\tbridges\n";
+    std::vector<std::thread> threads;
+    for( unsigned int t = 0; t < num_threads; t++ )
+        threads.push_back(std::thread(solve_puzzles, std::ref(batch), std::cref(solve)));
+
+    // read ahead of the solving threads, but only so far
+    for( unsigned long index = 0; ; index++ ) {
+        BatchPuzzle puzzle;
+        puzzle.index = index;
+        if( !read_puzzle(in, list, puzzle) )
+            break;
+        std::unique_lock<std::mutex> guard(batch.lock);
+        batch.changed.wait(guard, [&]() { return batch.waiting.size() < batch.max_waiting; });
+        batch.waiting.push_back(puzzle);
+        guard.unlock();
+        batch.changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> guard(batch.lock);
+        batch.done_reading = true;
+    }
+    batch.changed.notify_all();
+    for( unsigned int t = 0; t < threads.size(); t++ )
+        threads[t].join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    out << "# " << batch.written << " puzzles, " << batch.statuses["solved"] << " solved, "
+        << batch.statuses["unsolvable"] << " unsolvable, " << batch.statuses["timeout"]
+        << " timeout, " << batch.statuses["error"] << " error, " << seconds << " seconds"
+        << std::endl;
+}
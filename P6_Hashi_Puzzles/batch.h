@@ -0,0 +1,28 @@
+#ifndef batch_h
+#define batch_h
+
+#include <iostream>
+
+struct HashiOptions;
+
+// ====================================================================================
+// Solving many puzzles in one run. The puzzles come from in one at a time, and
+// options.threads threads solve them, each puzzle on one thread, with options'
+// engine and time_limit. Each puzzle gets a line on out, in the order they came in,
+// of tab-separated fields:
+//
+//     name  status  solutions  seconds  bridges
+//
+// status is solved, unsolvable, timeout (solutions then counts those found in time)
+// or error (bridges then says what was wrong). bridges is the solution found, the
+// last one with find_all_solutions, as space-separated x1,y1,x2,y2,count for each
+// pair of islands with bridges. Lines starting with # are comments: the first names
+// the fields, the last sums up.
+//
+// With list, each line of in names a puzzle file, and that is its name. Otherwise in
+// has the puzzles themselves, in the input file format, with a blank line after
+// each. A line "# name" before a puzzle names it; else it is named by its number.
+
+void solve_batch(std::istream &in, bool list, const HashiOptions &options, std::ostream &out);
+
+#endif
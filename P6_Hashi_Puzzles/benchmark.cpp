@@ -0,0 +1,144 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "graph.h"
+#include "generator.h"
+
+//
+// Timing runs of the Hashi engines on generated puzzles of growing size. Build with
+// "make benchmark".
+//
+
+void Usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--sizes 10,20,40] [--density D] [--count N] [--seed N]"
+              << std::endl;
+    std::cerr << "       [--unique] [--engine search|sat|both] [--time_limit S] [--connected]"
+              << std::endl;
+    std::cerr << "       [--find_all_solutions] [--most_constrained] [--threads N] [--table_mb N]"
+              << std::endl;
+    std::cerr << "  Solves count square puzzles of each size, and prints for each engine how"
+              << std::endl;
+    std::cerr << "  many it solved in time, the seconds and the nodes they took." << std::endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> sizes;
+    GeneratorOptions generator;
+    unsigned int count = 5;
+    bool search = true, sat = true;
+    HashiOptions options;
+    options.time_limit = 10;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] == std::string("--sizes") && i+1 < argc) {
+            std::istringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ','))
+                sizes.push_back(atoi(size.c_str()));
+        } else if (argv[i] == std::string("--density") && i+1 < argc) {
+            generator.density = atof(argv[++i]);
+        } else if (argv[i] == std::string("--count") && i+1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--seed") && i+1 < argc) {
+            generator.seed = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--unique")) {
+            generator.unique = true;
+        } else if (argv[i] == std::string("--engine") && i+1 < argc) {
+            std::string engine = argv[++i];
+            search = engine == "search" || engine == "both";
+            sat = engine == "sat" || engine == "both";
+            if (!search && !sat)
+                Usage(argv[0]);
+        } else if (argv[i] == std::string("--time_limit") && i+1 < argc) {
+            options.time_limit = atof(argv[++i]);
+        } else if (argv[i] == std::string("--connected")) {
+            options.connected = true;
+        } else if (argv[i] == std::string("--find_all_solutions")) {
+            options.find_all_solutions = true;
+        } else if (argv[i] == std::string("--most_constrained")) {
+            options.most_constrained = true;
+        } else if (argv[i] == std::string("--threads") && i+1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--table_mb") && i+1 < argc) {
+            options.table_mb = atoi(argv[++i]);
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (sizes.empty()) {
+        sizes.push_back(10);
+        sizes.push_back(20);
+        sizes.push_back(40);
+    }
+    if (count == 0 || generator.density <= 0 || generator.density > 1)
+        Usage(argv[0]);
+
+    std::ostream null(NULL);
+    options.verbosity = HashiOptions::QUIET;
+    options.print_solutions = false;
+    options.out = &null;
+    std::vector<unsigned int> engines;
+    if (search)
+        engines.push_back(HashiOptions::SEARCH);
+    if (sat)
+        engines.push_back(HashiOptions::SAT);
+    const char* names[] = { "search", "sat" };
+
+    std::cout << std::setw(6) << "size" << std::setw(9) << "islands" << std::setw(8) << "engine"
+              << std::setw(8) << "solved" << std::setw(12) << "mean_sec" << std::setw(12) << "max_sec"
+              << std::setw(14) << "mean_nodes" << std::setw(14) << "max_nodes" << std::endl;
+    for (unsigned int s = 0; s < sizes.size(); s++) {
+        if (sizes[s] < 3)
+            Usage(argv[0]);
+        generator.width = generator.height = sizes[s];
+        std::vector<Puzzle> puzzles;
+        double islands = 0;
+        for (unsigned int p = 0; p < count; p++) {
+            GeneratorOptions g = generator;
+            g.seed = generator.seed + p;
+            Puzzle puzzle;
+            if (!generate_puzzle(g, puzzle)) {
+                std::cerr << "No unique puzzle of size " << sizes[s] << " with seed " << g.seed
+                          << ", left out" << std::endl;
+                continue;
+            }
+            puzzles.push_back(puzzle);
+            islands += puzzle.islands.size();
+        }
+        if (puzzles.empty())
+            continue;
+        islands /= puzzles.size();
+
+        for (unsigned int e = 0; e < engines.size(); e++) {
+            options.engine = engines[e];
+            unsigned int solved = 0;
+            double seconds = 0, max_seconds = 0, nodes = 0;
+            unsigned long max_nodes = 0;
+            for (unsigned int p = 0; p < puzzles.size(); p++) {
+                Graph graph;
+                for (unsigned int i = 0; i < puzzles[p].islands.size(); i++)
+                    graph.addNode(Point(puzzles[p].islands[i].x, puzzles[p].islands[i].y),
+                                  puzzles[p].islands[i].n);
+                graph.hashi(options);
+                const HashiStats &stats = graph.get_stats();
+                if (!stats.timed_out && stats.solutions > 0)
+                    solved++;
+                seconds += stats.seconds;
+                max_seconds = std::max(max_seconds, stats.seconds);
+                nodes += stats.nodes;
+                max_nodes = std::max(max_nodes, stats.nodes);
+            }
+            std::cout << std::setw(6) << sizes[s] << std::setw(9) << std::fixed << std::setprecision(1)
+                      << islands << std::setw(8) << names[engines[e]] << std::setw(4) << solved << "/"
+                      << std::left << std::setw(3) << puzzles.size() << std::right
+                      << std::setprecision(4) << std::setw(12) << seconds / puzzles.size()
+                      << std::setw(12) << max_seconds << std::setprecision(0) << std::setw(14)
+                      << nodes / puzzles.size() << std::setw(14) << max_nodes << std::endl;
+        }
+    }
+}
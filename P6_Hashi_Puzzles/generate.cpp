@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "generator.h"
+
+//
+// Writes a generated Hashi puzzle in the input format. Build with "make generate".
+//
+
+void Usage(const char* program) {
+    std::cerr << "Usage: " << program << " <width> <height> [--density D] [--seed N] [--unique]"
+              << std::endl;
+    std::cerr << "  density is islands per cell of the board, 0.2 by default. A unique puzzle"
+              << std::endl;
+    std::cerr << "  has one solution that joins all the islands." << std::endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3)
+        Usage(argv[0]);
+    GeneratorOptions options;
+    options.width = atoi(argv[1]);
+    options.height = atoi(argv[2]);
+    for (int i = 3; i < argc; i++) {
+        if (argv[i] == std::string("--density") && i+1 < argc) {
+            options.density = atof(argv[++i]);
+        } else if (argv[i] == std::string("--seed") && i+1 < argc) {
+            options.seed = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--unique")) {
+            options.unique = true;
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (options.width < 3 || options.height < 3 || options.density <= 0 || options.density > 1)
+        Usage(argv[0]);
+
+    Puzzle puzzle;
+    if (!generate_puzzle(options, puzzle)) {
+        std::cerr << "ERROR!  No unique puzzle in " << puzzle.attempts << " attempts" << std::endl;
+        exit(1);
+    }
+    std::cout << puzzle;
+    std::cerr << puzzle.islands.size() << " islands, " << puzzle.bridges.size() << " bridges, "
+              << puzzle.attempts << " attempts, " << puzzle.repairs << " repairs" << std::endl;
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include "graph.h"
+#include "generator.h"
+
+// what a cell of the board being grown holds, when not an island's index
+static const int EMPTY = -1;
+static const int BRIDGE = -2;
+
+// Grow a network of bridges with about options.density islands per cell, or as many
+// as fit, into puzzle
+static void grow(const GeneratorOptions &options, std::mt19937 &rng, Puzzle &puzzle) {
+    static const int dx[4] = { 1, 0, -1, 0 };
+    static const int dy[4] = { 0, 1, 0, -1 };
+    int width = options.width, height = options.height;
+    std::vector<int> cell(width * height, EMPTY);
+    std::vector<Island> &islands = puzzle.islands;
+    std::vector<Bridge> &bridges = puzzle.bridges;
+    islands.clear();
+    bridges.clear();
+    unsigned int target = std::max(2, int(options.density * width * height + 0.5));
+    // bridges about as long as islands are apart
+    int max_span = std::max(2, int(2 / std::sqrt(options.density)));
+
+    Island first = { int(rng() % width), int(rng() % height), 0 };
+    islands.push_back(first);
+    cell[first.x + first.y * width] = 0;
+    for( unsigned long tries = 0; islands.size() < target && tries < 100ul * target; tries++ ) {
+        unsigned int a = rng() % islands.size();
+        int d = rng() % 4;
+        int span = 2 + rng() % (max_span - 1);
+        int x = islands[a].x + dx[d] * span, y = islands[a].y + dy[d] * span;
+        if( x < 0 || x >= width || y < 0 || y >= height )
+            continue;
+        // the bridge may cross nothing, and the new island may not touch another
+        bool clear = true;
+        for( int k = 1; k <= span; k++ )
+            if( cell[islands[a].x + dx[d] * k + (islands[a].y + dy[d] * k) * width] != EMPTY )
+                clear = false;
+        for( int n = 0; n < 4; n++ ) {
+            int nx = x + dx[n], ny = y + dy[n];
+            if( nx >= 0 && nx < width && ny >= 0 && ny < height && cell[nx + ny * width] >= 0 )
+                clear = false;
+        }
+        unsigned int count = std::min(1 + int(rng() % 2), 8 - islands[a].n);
+        if( !clear || count == 0 )
+            continue;
+
+        for( int k = 1; k < span; k++ )
+            cell[islands[a].x + dx[d] * k + (islands[a].y + dy[d] * k) * width] = BRIDGE;
+        cell[x + y * width] = islands.size();
+        Island island = { x, y, int(count) };
+        Bridge bridge = { a, (unsigned int)islands.size(), count };
+        islands[a].n += count;
+        islands.push_back(island);
+        bridges.push_back(bridge);
+    }
+
+    // put the islands in the order of the input files
+    std::vector<unsigned int> order(islands.size());
+    for( unsigned int i = 0; i < order.size(); i++ )
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned int i, unsigned int j) {
+        return std::make_pair(islands[i].y, islands[i].x) < std::make_pair(islands[j].y, islands[j].x);
+    });
+    std::vector<Island> sorted(islands.size());
+    std::vector<unsigned int> index(islands.size());
+    for( unsigned int i = 0; i < order.size(); i++ ) {
+        sorted[i] = islands[order[i]];
+        index[order[i]] = i;
+    }
+    islands.swap(sorted);
+    for( unsigned int i = 0; i < bridges.size(); i++ ) {
+        bridges[i].a = index[bridges[i].a];
+        bridges[i].b = index[bridges[i].b];
+    }
+}
+
+// Look for a solution of puzzle other than its bridges, under the connected rules,
+// and put how many bridges it has on each of puzzle.bridges into other. False if
+// there is none. Those counts are all it takes to tell the solutions apart: were
+// they the same, the islands would need no other bridges.
+static bool other_solution(const Puzzle &puzzle, std::vector<unsigned int> &other) {
+    Graph g;
+    std::map<std::pair<int, int>, unsigned int> index;
+    for( unsigned int i = 0; i < puzzle.islands.size(); i++ ) {
+        g.addNode(Point(puzzle.islands[i].x, puzzle.islands[i].y), puzzle.islands[i].n);
+        index[std::make_pair(puzzle.islands[i].x, puzzle.islands[i].y)] = i;
+    }
+    std::ostream null(NULL);
+    HashiOptions options;
+    options.engine = HashiOptions::SAT;
+    options.connected = true;
+    options.find_all_solutions = true;
+    options.max_solutions = 2;
+    options.verbosity = HashiOptions::QUIET;
+    options.print_solutions = false;
+    options.out = &null;
+    g.hashi(options);
+    if( g.get_stats().solutions < 2 )
+        return false;
+
+    for( int pass = 0; pass < 2; pass++ ) {
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> counts;
+        const std::vector<Edge> &edges = g.get_edges();
+        for( unsigned int i = 0; i < edges.size(); i++ ) {
+            unsigned int a = index[std::make_pair(edges[i].get_a().get_x(), edges[i].get_a().get_y())];
+            unsigned int b = index[std::make_pair(edges[i].get_b().get_x(), edges[i].get_b().get_y())];
+            counts[std::make_pair(std::min(a, b), std::max(a, b))]++;
+        }
+        bool same = true;
+        other.resize(puzzle.bridges.size());
+        for( unsigned int i = 0; i < puzzle.bridges.size(); i++ ) {
+            const Bridge &bridge = puzzle.bridges[i];
+            other[i] = counts[std::make_pair(std::min(bridge.a, bridge.b), std::max(bridge.a, bridge.b))];
+            same = same && other[i] == bridge.count;
+        }
+        if( !same )
+            return true;
+        // the second solution found was puzzle's own, so the first is the other one,
+        // and the solver finds it first again
+        options.max_solutions = 1;
+        g.hashi(options);
+    }
+    return false;
+}
+
+// Change a bridge of puzzle that has more on it than other, see generator.h. False
+// if none can change without an island needing more than 8.
+static bool repair(std::mt19937 &rng, const std::vector<unsigned int> &other, Puzzle &puzzle) {
+    std::vector<unsigned int> candidates;
+    for( unsigned int i = 0; i < puzzle.bridges.size(); i++ ) {
+        const Bridge &bridge = puzzle.bridges[i];
+        if( bridge.count > other[i] && (bridge.count == 2
+              || (puzzle.islands[bridge.a].n < 8 && puzzle.islands[bridge.b].n < 8)) )
+            candidates.push_back(i);
+    }
+    if( candidates.empty() )
+        return false;
+    Bridge &bridge = puzzle.bridges[candidates[rng() % candidates.size()]];
+    int change = bridge.count == 1 ? 1 : -1;
+    bridge.count += change;
+    puzzle.islands[bridge.a].n += change;
+    puzzle.islands[bridge.b].n += change;
+    return true;
+}
+
+bool generate_puzzle(const GeneratorOptions &options, Puzzle &puzzle) {
+    std::mt19937 rng(options.seed);
+    for( unsigned int attempt = 1; attempt <= options.max_attempts; attempt++ ) {
+        puzzle.attempts = attempt;
+        puzzle.repairs = 0;
+        grow(options, rng, puzzle);
+        if( !options.unique )
+            return true;
+        std::vector<unsigned int> other;
+        while( other_solution(puzzle, other) ) {
+            if( puzzle.repairs == options.max_repairs || !repair(rng, other, puzzle) )
+                break;
+            puzzle.repairs++;
+            other.clear();
+        }
+        if( other.empty() )
+            return true;
+    }
+    return false;
+}
+
+// helper function for writing a Puzzle in the input format
+std::ostream& operator<<(std::ostream &ostr, const Puzzle &p) {
+    for( unsigned int i = 0; i < p.islands.size(); i++ )
+        ostr << p.islands[i].x << " " << p.islands[i].y << " " << p.islands[i].n << "\n";
+    return ostr;
+}
@@ -0,0 +1,58 @@
+#ifndef generator_h
+#define generator_h
+
+#include <vector>
+#include <iostream>
+
+// ====================================================================================
+// Making Hashi puzzles that are sure to have a solution: a network of bridges grows
+// out from one island, each new island joined to one already there by a bridge that
+// crosses nothing, and each island gets the number of bridges it ended up with. The
+// network is the solution, and it joins all the islands.
+//
+// A unique puzzle is one with just that solution under the --connected rules. When
+// a puzzle has another solution, some bridge of the network has more on it than the
+// other solution has. Going from 1 to 2 bridges there, or 2 to 1, changes the numbers
+// of its two islands, which rules the other solution out and keeps the network a
+// solution. This repair goes on until the puzzle is unique, or it has taken too many
+// and a new puzzle is started.
+
+struct GeneratorOptions {
+    GeneratorOptions() : width(10), height(10), density(0.2), unique(false), seed(1),
+                         max_repairs(200), max_attempts(20) {}
+    int width;
+    int height;
+    double density;             // islands per cell of the board
+    bool unique;                // only puzzles with one connected solution
+    unsigned int seed;
+    unsigned int max_repairs;   // of one puzzle before starting a new one
+    unsigned int max_attempts;  // puzzles to start before giving up
+};
+
+struct Island {
+    int x;
+    int y;
+    int n;                      // bridges it needs
+};
+
+// count bridges between islands a and b
+struct Bridge {
+    unsigned int a;
+    unsigned int b;
+    unsigned int count;
+};
+
+struct Puzzle {
+    std::vector<Island> islands;    // by row, then by column
+    std::vector<Bridge> bridges;    // the solution it was made from
+    unsigned int attempts;          // puzzles started
+    unsigned int repairs;           // made to the last one
+};
+
+// Make a puzzle into puzzle. False if options.unique and none came out unique.
+bool generate_puzzle(const GeneratorOptions &options, Puzzle &puzzle);
+
+// helper function for writing a Puzzle in the input format, a line "x y n" an island
+std::ostream& operator<<(std::ostream &ostr, const Puzzle &p);
+
+#endif
@@ -71,6 +71,10 @@ Graph::Graph() {
     // We track the maximum dimensions of the graph.
     max_x = 0;
     max_y = 0;
+    verbosity = HashiOptions::TRACE;
+    solution_limit = 1;
+    out = &std::cout;
+    table_bytes = 0;
 }
 
 
@@ -91,14 +95,25 @@ void Graph::addEdge(const Point &a, const Point &b) {
 }
 
 
-void Graph::printSolution() const {
-    for (int i = 0; i < edges.size(); i++) {
-        std::cout << edges[i] << std::endl;
+void Graph::printSolution(std::ostream &ostr) const {
+    printBridges(edges, ostr);
+}
+
+
+void Graph::printGraph(std::ostream &ostr) const {
+    printBoard(edges, ostr);
+}
+
+
+void Graph::printBridges(const std::vector<Edge> &bridges, std::ostream &ostr) const {
+    for (int i = 0; i < bridges.size(); i++) {
+        ostr << bridges[i] << std::endl;
     }
 }
 
 
-void Graph::printGraph() const {
+// draw the islands with bridges between them
+void Graph::printBoard(const std::vector<Edge> &bridges, std::ostream &ostr) const {
     // a graph should have at least one node/island
     assert (nodes.size() > 1);
     // the dimensions of the board should be positive
@@ -116,9 +131,9 @@ void Graph::printGraph() const {
     }
     
     // loop over all of the edges/bridges
-    for (int i = 0; i < edges.size(); i++) {
-        Point a = edges[i].get_a();
-        Point b = edges[i].get_b();
+    for (int i = 0; i < bridges.size(); i++) {
+        Point a = bridges[i].get_a();
+        Point b = bridges[i].get_b();
         // determine the edge/edge direction
         int diff_x = b.get_x()-a.get_x();
         int diff_y = b.get_y()-a.get_y();
@@ -161,11 +176,11 @@ void Graph::printGraph() const {
     
     // surround the board with a border of spaces
     char border = ' ';
-    std::cout << std::string(board[0].size()+2,border) << std::endl;
+    ostr << std::string(board[0].size()+2,border) << std::endl;
     for (int i = board.size()-1; i >= 0; i--) {
-        std::cout << border << board[i] << border << std::endl;
+        ostr << border << board[i] << border << std::endl;
     }
-    std::cout << std::string(board[0].size()+2,border) << std::endl;
+    ostr << std::string(board[0].size()+2,border) << std::endl;
 }
 
 // ====================================================================================
@@ -1,4 +1,8 @@
 #include <vector>
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+#include "transposition_table.h"
 
 // ====================================================================================
 // A Point is just a 2D coordinate.
@@ -98,6 +102,58 @@ private:
 std::ostream& operator<<(std::ostream &ostr, const Edge &e);
 std::ostream& operator<<(std::ostream &ostr, const std::vector<Edge> &edges);
 
+// ====================================================================================
+// How Graph::hashi() searches, as chosen on the command line.
+
+struct HashiOptions {
+    HashiOptions() : connected(false), find_all_solutions(false), most_constrained(false),
+                     verbosity(TRACE), threads(1), engine(SEARCH), time_limit(0),
+                     print_solutions(true), max_solutions(0), out(&std::cout),
+                     table_mb(16) {}
+    bool connected;             // only solutions whose bridges join all the islands
+    bool find_all_solutions;
+    bool most_constrained;      // branch on the island with the fewest stepwise solutions
+    unsigned int verbosity;     // what gets printed besides the solutions, see below
+    unsigned int threads;       // to search with, 0 for one per core. More than one only
+                                // helps find_all_solutions, and prints at most EVENTS
+    unsigned int engine;        // SEARCH or SAT, see below
+    double time_limit;          // seconds to give up after, 0 for no limit
+    bool print_solutions;       // false to only count them
+    unsigned long max_solutions;    // with find_all_solutions, stop after this many, 0
+                                    // for no limit. Searches on one thread
+    std::ostream *out;          // where the solutions, statistics and tracing go
+    unsigned int table_mb;      // megabytes for the transposition tables of the search's
+                                // threads, 0 for none. See hashi_r
+
+    // verbosity levels, each printing everything the one before does
+    static const unsigned int QUIET = 0;    // the solutions and the statistics only
+    static const unsigned int EVENTS = 1;   // why branches and solutions are ruled out
+    static const unsigned int TRACE = 2;    // every call with its board, stepwise solutions
+                                            // and forced bridges
+
+    // engines
+    static const unsigned int SEARCH = 0;   // hashi_r, branching on stepwise solutions
+    static const unsigned int SAT = 1;      // hashi_sat, clause learning, see hashi_sat.cpp
+};
+
+// What the last search did. Each call of hashi_r is a node of the search tree.
+struct HashiStats {
+    HashiStats() : nodes(0), dead_ends(0), branches(0), backtracks(0), max_depth(0),
+                   solutions(0), table_hits(0), seconds(0), timed_out(false) {}
+    unsigned long nodes;
+    unsigned long dead_ends;    // nodes ruled out by propagation or without stepwise solutions
+    unsigned long branches;     // stepwise solutions tried
+    unsigned long backtracks;   // stepwise solutions tried that led to no solution
+    unsigned int max_depth;
+    unsigned long solutions;    // printed, so connected ones only with --connected
+    unsigned long table_hits;   // nodes not searched, as the transposition table knew them
+    double seconds;             // wall time of the search
+    bool timed_out;             // gave up at the time limit, so the counts are partial
+};
+
+// helper function for printing HashiStats
+std::ostream& operator<<(std::ostream &ostr, const HashiStats &s);
+
 // ====================================================================================
 // A Graph is a collection of Nodes and Edges.
 
@@ -109,29 +165,137 @@ public:
     void addNode(const Point &p, int n);
     void addEdge(const Point &a, const Point &b);
     // print helper functions
-    void printSolution() const;
-    void printGraph() const;
+    void printSolution(std::ostream &ostr = std::cout) const;
+    void printGraph(std::ostream &ostr = std::cout) const;
     // hashi
     bool empty() const { return nodes.empty(); }
-    void hashi(bool connected, bool find_all_solutions);
+    void hashi(const HashiOptions &options);
+    const HashiStats& get_stats() const { return stats; }
+    // the last solution hashi() found, or one of them when searching in parallel
+    const std::vector<Edge>& get_edges() const { return edges; }
 private:
     // representation
     int max_x;
     int max_y;
     std::vector<Node> nodes;
     std::vector<Edge> edges;
+    HashiStats stats;
+    unsigned int verbosity;     // of the search going on, from its HashiOptions
+    unsigned long solution_limit;   // of the search going on: stop after this many
+                                    // solutions, 0 for no limit
+    std::ostream *out;          // of the search going on, from its HashiOptions
+    size_t table_bytes;         // of each thread's transposition table, ditto
+    std::chrono::steady_clock::time_point deadline; // of the search going on, if it has a
+                                                    // time_limit
+    // Island i has a slot for each direction d: 0 right, 1 down, 2 left, 3 up, and
+    // slot 4*i+d is the nearest island that way, or NO_ISLAND. Slot 4*i+(d^2) of that
+    // island leads back to i. Bridges can only go from an island to these.
+    static const unsigned int NO_ISLAND = ~0u;
+    std::vector<unsigned int> adjacent;
+    // The pairs of adjacent islands are the candidate edges, numbered 0..E-1 in the
+    // order of their first island. The search keeps 2 bits for each edge, 32 edges
+    // to a word: how many bridges it has. The edges crossing edge e are a bitmask in
+    // that layout, kept as the words it has bits in: crossings[cross_start[e]] up to
+    // crossings[cross_start[e+1]].
+    struct CrossMask {
+        unsigned int word;
+        uint64_t bits;          // the low bit of each crossing edge's 2 bits
+    };
+    std::vector<unsigned int> slot_edge;    // edge of slot s, when adjacent[s] is an island
+    std::vector<std::pair<unsigned int, unsigned int> > edge_ends;  // islands of edge e
+    std::vector<CrossMask> crossings;
+    std::vector<unsigned int> cross_start;
+    // Random numbers to hash search states with, see residual_key: zobrist[8*i+n-1]
+    // for island i needing n more bridges, zobrist[8*nodes.size()+2*e+c-1] for edge e
+    // able to take c more.
+    std::vector<uint64_t> zobrist;
+    
+    // The stepwise solutions of one island: in solution s, counts[s*k+i] bridges go
+    // to island nbrs[i] over edge edges[i], for k = nbrs.size(). caps[i] is what
+    // nbrs[i] can take.
+    struct Stepwise {
+        std::vector<unsigned int> nbrs;
+        std::vector<unsigned int> edges;
+        std::vector<unsigned int> caps;
+        std::vector<unsigned int> counts;
+        unsigned int size() const { return nbrs.empty() ? 0 : counts.size() / nbrs.size(); }
+    };
+    // searching in parallel, see hashi_parallel.cpp
+    struct Task;
+    struct Worker;
+    struct TaskPool;
+    
+    // scratch space of one level of the search, kept from one call to the next
+    struct Level {
+        Stepwise best;          // of the island to branch on
+        Stepwise candidate;
+    };
+    // The state of a search, changed in place as hashi_r goes down the search tree
+    // and put back as it returns. Each bridge placed is pushed on solution, so
+    // taking the bridges off back to an earlier size of solution undoes everything
+    // since then.
+    struct SearchState {
+        std::vector<unsigned char> demand;  // bridges island i still needs, 0 when it's done
+        std::vector<uint64_t> bridges;      // 2 bits for each edge, see CrossMask
+        std::vector<unsigned int> solution; // bridges placed so far, in order, each as 2*e
+                                            // for its edge e, +1 if placed from the
+                                            // edge's second island
+        // The islands the bridges so far join into groups, as a union-find without
+        // path compression, so that undo can split a group up again. Only the root
+        // of a group has its size and open right.
+        std::vector<unsigned int> group;    // parent of island i, i itself at a root
+        std::vector<unsigned int> size;     // islands in the group
+        std::vector<unsigned int> open;     // bridges the group's islands still need
+        std::vector<unsigned int> merged;   // root solution[i] put under another, or NO_ISLAND
+        unsigned int closed;                // groups needing no more bridges that lack
+                                            // some islands, so can never join the rest
+        HashiStats stats;                   // of this search, or this thread's share of it
+        std::ostream *out;                  // where tracing and solutions go
+        Worker *worker;                     // NULL unless searching in parallel
+        std::vector<unsigned int> path;     // the stepwise solution taken at each depth
+        unsigned long spawned;              // Tasks handed to other threads
+        std::vector<Level> levels;          // one for each depth
+        bool stopped;                       // at the deadline, so hashi_r returns at once
+        std::vector<Edge> last_solution;    // the bridges of the last solution found
+        TranspositionTable table;           // solutions below the states searched
+        std::vector<unsigned int> first_in_group;   // scratch for residual_key
+    };
     
     // helper functions
-    void reduce_node(const Point &p);
-    void reduce(const std::vector<Edge> &stepwise_solution, const Node &node);
-    void hashi_r(Graph subgraph, std::vector<Edge> partial_solution,
-                 bool connected, bool find_all_solutions);
-    std::vector<std::vector<Edge>> stepwise(const Graph &subgraph, const Node &node,
-                                            const std::vector<Edge> &p_solutions);
-    bool bridge_crosses_nodes(const Edge &bridge) const;
-    bool connected() const;
-    void reach_nodes(std::vector<Node> &reached_nodes, unsigned int tried_index) const;
-    void printPartialGraph(const std::vector<Edge> &partial_solution, const Graph &remaining_graph);
+    void start_search(SearchState &state) const;
+    void hashi_r(SearchState &state, const HashiOptions &options, unsigned int depth) const;
+    void hashi_sat(const HashiOptions &options);
+    void place_stepwise(SearchState &state, unsigned int island, const Stepwise &choices,
+                        unsigned int s) const;
+    void stepwise(const SearchState &state, unsigned int island, Stepwise &result) const;
+    void neighbors(const SearchState &state, unsigned int island, Stepwise &result) const;
+    bool propagate(SearchState &state, Stepwise &scratch) const;
+    void place_bridge(SearchState &state, unsigned int e, unsigned int from) const;
+    void undo(SearchState &state, unsigned int mark) const;
+    std::vector<Node> remaining_nodes(const SearchState &state) const;
+    std::vector<Edge> solution_edges(const SearchState &state) const;
+    void find_adjacent();
+    void find_crossings();
+    unsigned int bridge_count(const SearchState &state, unsigned int e) const {
+        return (state.bridges[e / 32] >> (2 * (e % 32))) & 3;
+    }
+    bool crossed(const SearchState &state, unsigned int e) const;
+    uint64_t residual_key(SearchState &state, bool connected) const;
+    unsigned int find_group(const SearchState &state, unsigned int island) const;
+    void printPartialGraph(const std::vector<Edge> &partial_solution,
+                           const std::vector<Node> &remaining_nodes, std::ostream &ostr) const;
+    void printBridges(const std::vector<Edge> &bridges, std::ostream &ostr) const;
+    void printBoard(const std::vector<Edge> &bridges, std::ostream &ostr) const;
+    // parallel search helper functions
+    void hashi_parallel(const HashiOptions &options, unsigned int num_threads);
+    void work(TaskPool &pool, unsigned int w, const HashiOptions &options) const;
+    Task* take(TaskPool &pool, unsigned int w) const;
+    void finish(TaskPool &pool, Task *task) const;
+    bool workers_idle(const SearchState &state) const;
+    void spawn(SearchState &state, unsigned int island, const Stepwise &choices,
+               unsigned int s) const;
+    void start_solution(SearchState &state) const;
+    void defer(SearchState &state, unsigned long solutions) const;
 };
 
 // ====================================================================================
@@ -1,263 +1,624 @@
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <random>
 #include "graph.h"
 
 // Ray
 
 unsigned int min( unsigned int x, unsigned int y);
 bool in_middle( unsigned int x, unsigned int end1, unsigned int end2 );
+uint64_t mix( uint64_t x );
 
-void Graph::hashi(bool connected, bool find_all_solutions) {
-    std::vector<Edge> partial_solution;
+const unsigned int Graph::NO_ISLAND;
+const unsigned int HashiOptions::QUIET;
+const unsigned int HashiOptions::EVENTS;
+const unsigned int HashiOptions::TRACE;
+const unsigned int HashiOptions::SEARCH;
+const unsigned int HashiOptions::SAT;
+
+void Graph::hashi(const HashiOptions &options) {
+    find_adjacent();
+    find_crossings();
+    std::mt19937_64 random(1);
+    zobrist.resize(8 * nodes.size() + 2 * edge_ends.size());
+    for( unsigned int i = 0; i < zobrist.size(); i++ )
+        zobrist[i] = random();
+    verbosity = options.verbosity;
+    solution_limit = options.find_all_solutions ? options.max_solutions : 1;
+    out = options.out;
+    edges.clear();
+    unsigned int num_threads = options.threads;
+    if( num_threads == 0 )
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
     
-    hashi_r(*this, partial_solution, connected, find_all_solutions);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                           std::chrono::duration<double>(options.time_limit));
+    if( options.engine == HashiOptions::SAT ) {
+        hashi_sat(options);
+        return;
+    }
+    bool parallel = num_threads > 1 && options.find_all_solutions && solution_limit == 0;
+    table_bytes = (size_t(options.table_mb) << 20) / (parallel ? num_threads : 1);
+    if( parallel ) {
+        // the trace of one thread makes no sense in between those of the others
+        if( verbosity > HashiOptions::EVENTS )
+            verbosity = HashiOptions::EVENTS;
+        hashi_parallel(options, num_threads);
+    }
+    else {
+        SearchState state;
+        start_search(state);
+        hashi_r(state, options, 0);
+        stats = state.stats;
+        stats.timed_out = state.stopped;
+        edges.swap(state.last_solution);
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    *out << "STATISTICS: " << stats << std::endl;
 }
 
-// The recursive function
+// Set state up for a search from the start, on this thread
+void Graph::start_search(SearchState &state) const {
+    for( unsigned int i = 0; i < nodes.size(); i++ )
+        state.demand.push_back(nodes[i].get_num_paths());
+    // every level of the search finishes at least the island it branches on, so
+    // there are at most nodes.size()+1 levels, and their scratch space is made once
+    state.levels.resize(nodes.size() + 1);
+    state.bridges.assign((edge_ends.size() + 31) / 32, 0);
+    for( unsigned int i = 0; i < nodes.size(); i++ ) {
+        state.group.push_back(i);
+        state.size.push_back(1);
+    }
+    state.open.assign(state.demand.begin(), state.demand.end());
+    state.closed = 0;
+    state.out = out;
+    state.worker = NULL;
+    state.spawned = 0;
+    state.stopped = false;
+    state.table.reset(table_bytes);
+    state.first_in_group.resize(nodes.size());
+}
+
+// helper function for printing HashiStats
+std::ostream& operator<<(std::ostream &ostr, const HashiStats &s) {
+    ostr << s.nodes << " nodes, " << s.branches << " branches, " << s.backtracks
+         << " backtracks, " << s.dead_ends << " dead ends, max depth " << s.max_depth
+         << ", " << s.solutions << " solutions, " << s.table_hits << " table hits, "
+         << s.seconds << " seconds";
+    if( s.timed_out )
+        ostr << ", timed out";
+    return ostr;
+}
+
+// The recursive function. It changes state in place and leaves it as it found it.
 void
 Graph::hashi_r
 (
- Graph remaining_graph, // remaining graph
- std::vector<Edge> partial_solution,
- bool to_be_connected,
- bool find_all_solutions
-)
+ SearchState &state,
+ const HashiOptions &options,
+ unsigned int depth
+) const
 {
-    static unsigned int solution_id = 0;
+    if( (solution_limit > 0 && state.stats.solutions >= solution_limit) || state.stopped )
+        return;
+    
+    state.stats.nodes++;
+    if( options.time_limit > 0 && state.stats.nodes % 1024 == 0
+       && std::chrono::steady_clock::now() > deadline ) {
+        if( verbosity >= HashiOptions::EVENTS )
+            *state.out << "    Out of time." << std::endl;
+        state.stopped = true;
+        return;
+    }
+    state.stats.max_depth = std::max(state.stats.max_depth, depth);
+    
+    if( verbosity >= HashiOptions::TRACE ) {
+        std::vector<Node> remaining = remaining_nodes(state);
+        std::vector<Edge> partial_solution = solution_edges(state);
+        *state.out << "\nRecursive call to hashi_r ========================================= \n"
+        << "    partial_solution: " << partial_solution << "\n"
+        << "    remaining_graph: " << remaining << "\n";
+        printPartialGraph(partial_solution, remaining, *state.out);
+    }
+    
+    // everything placed from here on is taken off again before returning
+    unsigned int mark = state.solution.size();
+    Level &level = state.levels[depth];
     
-    if( !find_all_solutions && solution_id>0 )
+    // place the bridges that are forced before branching
+    if( !propagate(state, level.candidate) ) {
+        if( verbosity >= HashiOptions::EVENTS )
+            *state.out << "    Propagation ruled this branch out." << std::endl;
+        state.stats.dead_ends++;
+        undo(state, mark);
         return;
+    }
+    // a group of islands that needs no more bridges can't join the others anymore
+    if( options.connected && state.closed > 0 ) {
+        if( verbosity >= HashiOptions::EVENTS )
+            *state.out << "    A closed off group of islands ruled this branch out." << std::endl;
+        state.stats.dead_ends++;
+        undo(state, mark);
+        return;
+    }
     
-    std::cout << "\nRecursive call to hashi_r ========================================= \n"
-    << "    partial_solution: " << partial_solution << "\n"
-    << "    remaining_graph: " << remaining_graph.nodes << "\n";
-    printPartialGraph(partial_solution, remaining_graph);
+    // Different bridges on the islands done so far can leave the same islands to do,
+    // and then the same search below. One searched before had no solutions, or if
+    // they're only counted, has as many as then.
+    uint64_t key = state.table.bytes() > 0 ? residual_key(state, options.connected) : 0;
+    unsigned long known;
+    if( state.table.find(key, known)
+       && (known == 0 || (!options.print_solutions && solution_limit == 0)) ) {
+        if( verbosity >= HashiOptions::EVENTS )
+            *state.out << "    Searched before, with " << known << " solutions." << std::endl;
+        state.stats.table_hits++;
+        state.stats.solutions += known;
+        undo(state, mark);
+        return;
+    }
+    unsigned long entry_nodes = state.stats.nodes;
+    unsigned long entry_solutions = state.stats.solutions;
+    unsigned long entry_spawned = state.spawned;
     
-    // If remaning_graph is empty, we have found a solution. Print it.
-    if( remaining_graph.empty() ) {
-        // put partial_solution into this graph so it can be properly processed.
-        edges = partial_solution;
-        if( !to_be_connected || connected() ) {
-            ++solution_id;
-            std::cout << "SOLUTION " << solution_id << "===========" << std::endl;
-            printSolution();
-            printGraph();
+    // If no island needs more bridges, we have found a solution. Print it.
+    unsigned int first = 0;
+    while( first < nodes.size() && state.demand[first] == 0 )
+        first++;
+    if( first == nodes.size() ) {
+        // With options.connected there is just one group by now, else it would be
+        // closed off. In parallel the solution gets its number once it's printed.
+        ++state.stats.solutions;
+        state.last_solution = solution_edges(state);
+        if( options.print_solutions ) {
+            if( state.worker != NULL )
+                start_solution(state);
+            else
+                *state.out << "SOLUTION " << state.stats.solutions << "===========" << std::endl;
+            printBridges(state.last_solution, *state.out);
+            printBoard(state.last_solution, *state.out);
         }
-        else
-            std::cout << "SOLUTION FOUND but ruled out since it's not conneced." << std::endl;
+        undo(state, mark);
         return;
     }
     
-    // take the 1st node from remaning_graph
-    std::vector<Node> &r_nodes = remaining_graph.nodes;
-    Node node = r_nodes[0];
-    r_nodes.erase(r_nodes.begin()); // can use pop_back() instead so it's faster
-    
     // figure out all the stepwise solutions, each of which is a possible set of bridges
-    // the node has with its neighbors
-    std::vector<std::vector<Edge>> stepwise_solutions
-        = stepwise(remaining_graph, node, partial_solution);
+    // the node has with its neighbors. Take the 1st island that needs bridges, or
+    // with most_constrained the island with the fewest stepwise solutions.
+    Stepwise &best = level.best;
+    unsigned int chosen = first;
+    if( options.most_constrained ) {
+        for( unsigned int i = first; i < nodes.size(); i++ ) {
+            if( state.demand[i] == 0 )
+                continue;
+            stepwise(state, i, level.candidate);
+            if( i == first || level.candidate.size() < best.size() ) {
+                chosen = i;
+                std::swap(best, level.candidate);
+            }
+            // no island can do better than a dead end or a single choice
+            if( best.size() <= 1 )
+                break;
+        }
+    }
+    else
+        stepwise(state, chosen, best);
+    if( best.size() == 0 )
+        state.stats.dead_ends++;
     
     // If no more stepwise solution, the exploration has failed. Just return.
-    // Otherwise, for each stepwise solution, add it to partial_solution,
-    // deduct it from remaining graph, and call hashi_r recursively.
-    for( unsigned int i = 0; i < stepwise_solutions.size(); i++ )    {
-        std::vector<Edge> solution = stepwise_solutions[i];
-        // make a copy of partial_solution and remaining_graph, update them,
-        // and pass them into the recursive call.
-        std::vector<Edge> partial_solution_1 = partial_solution;
-        Graph remaining_graph_1 = remaining_graph;
-        for( unsigned int j = 0; j < solution.size(); j++ )
-            partial_solution_1.push_back(solution[j]);
-        remaining_graph_1.reduce(solution, node);
-        hashi_r(remaining_graph_1, partial_solution_1, to_be_connected, find_all_solutions);
+    // Otherwise, for each stepwise solution, place its bridges, call hashi_r
+    // recursively, and take them off again.
+    unsigned int branch_mark = state.solution.size();
+    unsigned int end = best.size();
+    for( unsigned int s = 0; s < end; s++ )    {
+        if( (solution_limit > 0 && state.stats.solutions >= solution_limit) || state.stopped )
+            break;
+        // hand the stepwise solutions after this one to threads that have nothing to do
+        if( state.worker != NULL && s + 1 < end && workers_idle(state) ) {
+            for( unsigned int t = end - 1; t > s; t-- )
+                spawn(state, chosen, best, t);
+            end = s + 1;
+        }
+        place_stepwise(state, chosen, best, s);
+        state.stats.branches++;
+        state.path.push_back(s);
+        unsigned long solutions = state.stats.solutions;
+        unsigned long spawned = state.spawned;
+        hashi_r(state, options, depth + 1);
+        // whether a branch found a solution is only known once the Tasks handed
+        // out below it are done
+        if( state.spawned != spawned )
+            defer(state, state.stats.solutions - solutions);
+        else if( state.stats.solutions == solutions )
+            state.stats.backtracks++;
+        state.path.pop_back();
+        undo(state, branch_mark);
+        // the rest comes after the Tasks handed out below, so it's handed out as well
+        if( state.spawned != spawned ) {
+            for( unsigned int t = end - 1; t > s; t-- )
+                spawn(state, chosen, best, t);
+            end = s + 1;
+        }
     }
+    // remember the state, unless its search was cut short or left partly to other threads
+    if( !state.stopped && state.spawned == entry_spawned
+       && (solution_limit == 0 || state.stats.solutions < solution_limit) )
+        state.table.store(key, state.stats.solutions - entry_solutions,
+                          state.stats.nodes - entry_nodes);
+    undo(state, mark);
 
-    std::cout << "\nRETURN from hashi_r ========================================= \n"
-    << "    partial_solution: " << partial_solution << "\n"
-    << "    remaining_graph: " << remaining_graph.nodes << "\n";
+    if( verbosity >= HashiOptions::TRACE )
+        *state.out << "\nRETURN from hashi_r ========================================= \n"
+        << "    partial_solution: " << solution_edges(state) << "\n"
+        << "    remaining_graph: " << remaining_nodes(state) << "\n";
 }
 
-// figure out all the stepwise solutions, each of which is a possible set of bridges
-// the node has with its neighbors within the subgraph
-std::vector<std::vector<Edge>>
-Graph::stepwise(const Graph &subgraph, const Node &node, const std::vector<Edge> &p_solution) {
-    std::vector<std::vector<Edge>> solutions;
+// Place the bridges of stepwise solution s of island
+void Graph::place_stepwise(SearchState &state, unsigned int island, const Stepwise &choices,
+                           unsigned int s) const {
+    unsigned int k = choices.nbrs.size();
+    for( unsigned int n = 0; n < k; n++ )
+        for( unsigned int j = 0; j < choices.counts[s*k+n]; j++ )
+            place_bridge(state, choices.edges[n], island);
+}
 
-    std::cout << "  Stepwise() with Node " << node << std::endl;
+// figure out all the stepwise solutions of island, each of which is a possible set of
+// bridges the island has with its neighbors, into result
+void Graph::stepwise(const SearchState &state, unsigned int island, Stepwise &result) const {
+    result.counts.clear();
 
-    // find all its neighbors, except whose resulting bridge crosses p_solutions
-    const std::vector<Node> &s_nodes = subgraph.nodes;
-    std::vector<Node> neighbors;
-    for(unsigned int i=0; i<s_nodes.size(); i++) {
-        if(s_nodes[i].is_neighbor(node))    {
-            Edge bridge(node, s_nodes[i]);
-            if(subgraph.bridge_crosses_nodes(bridge)) {
-                // std::cout << "  BRIDGE " << bridge << " CROSSES NODES" << std::endl;
-                continue;
-            }
-            if(bridge.crosses(p_solution)) {
-                // std::cout << "  BRIDGE " << bridge << " CROSSES p_solution" << std::endl;
-                continue;
-            }
-            neighbors.push_back(s_nodes[i]);
-        }
+    bool trace = verbosity >= HashiOptions::TRACE;
+    if( trace )
+        *state.out << "  Stepwise() with Node " << Node(nodes[island].get_pt(), state.demand[island])
+                  << std::endl;
+
+    // find all its neighbors, and how many more bridges each can take
+    neighbors(state, island, result);
+    if( trace ) {
+        *state.out << "    Neighbors: ";
+        for( unsigned int i=0; i<result.nbrs.size(); i++ )
+            *state.out << nodes[result.nbrs[i]].get_pt() << ", " << unsigned(state.demand[result.nbrs[i]]) << "; ";
+        *state.out << std::endl;
     }
-    std::cout << "    Neighbors: " << neighbors << std::endl;
     
     // find all stepwise solutions
-    unsigned int num_bridges = node.get_num_paths();
+    unsigned int num_bridges = state.demand[island];
+    unsigned int k = result.nbrs.size();
     assert( 0 < num_bridges );
-    assert( neighbors.size() <= 4 );
+    assert( k <= 4 );
     
     // how many ways can we allocate num_bridges over its neighbors
-    // so each neighbor gets 0 or 1 or 2 but no more than its num_paths?
-     if( neighbors.empty() ) {
-         std::cout << "    NO Stepwise solution: neighbors=0\n";
-     } else if( neighbors.size() == 1 && num_bridges <= 2 ) {
-         Node neighbor = neighbors[0];
-         unsigned int num_paths = neighbor.get_num_paths();
-         assert( 0 < num_paths );
-         for( unsigned int north=1; north<=min(num_paths,2); north++ ) {
-             if( north == num_bridges ) {
-                 std::cout << "    Stepwise solution: " << north << "\n";
-                 std::vector<Edge> solution;
-                 for( unsigned int i=0; i<north; i++ ){
-                     Edge e(node, neighbors[0]);
-                     solution.push_back( e );
-                 }
-                 solutions.push_back( solution );
-             }
-         }
-         if(solutions.empty())
-             std::cout << "    NO Stepwise solution: neighbors=1, bridges=" << num_bridges << "\n";
-     } else if( neighbors.size() == 2  && num_bridges <= 4 ) {
-         for( unsigned int north=0; north<=min(neighbors[0].get_num_paths(),2); north++ )
-             for( unsigned int east=0; east<=min(neighbors[1].get_num_paths(),2); east++ )
-                 if( north+east == num_bridges ) {
-                     std::cout << "    Stepwise solution: " << north << ", "
-                     << east << "\n";
-                     std::vector<Edge> solution;
-                     for( unsigned int i=0; i<north; i++ ){
-                         Edge e(node, neighbors[0]);
-                         solution.push_back( e );
-                     }
-                     for( unsigned int i=0; i<east; i++ ){
-                         Edge e(node, neighbors[1]);
-                         solution.push_back( e );
-                     }
-                     solutions.push_back( solution );
-                 }
-         if(solutions.empty())
-             std::cout << "    NO Stepwise solution: neighbors=2, bridges=" << num_bridges << "\n";
-     } else if( neighbors.size() == 3  && num_bridges <= 6 ) {
-         for( unsigned int north=0; north<=min(neighbors[0].get_num_paths(),2); north++ )
-             for( unsigned int east=0; east<=min(neighbors[1].get_num_paths(),2); east++ )
-                 for( unsigned int south=0; south<=min(neighbors[2].get_num_paths(),2); south++ )
-                     if( north+east+south == num_bridges ) {
-                         std::cout << "    Stepwise solution: " << north << ", "
-                         << east << ", " << south << "\n";
-                         std::vector<Edge> solution;
-                         for( unsigned int i=0; i<north; i++ ){
-                             Edge e(node, neighbors[0]);
-                             solution.push_back( e );
-                         }
-                         for( unsigned int i=0; i<east; i++ ){
-                             Edge e(node, neighbors[1]);
-                             solution.push_back( e );
-                         }
-                         for( unsigned int i=0; i<south; i++ ){
-                             Edge e(node, neighbors[2]);
-                             solution.push_back( e );
-                         }
-                         solutions.push_back( solution );
-                     }
-         if(solutions.empty())
-             std::cout << "    NO Stepwise solution: neighbors=3, bridges=" << num_bridges << "\n";
-     } else if( neighbors.size() == 4  && num_bridges <= 8 ) {
-         for( unsigned int north=0; north<=min(neighbors[0].get_num_paths(),2); north++ )
-             for( unsigned int east=0; east<=min(neighbors[1].get_num_paths(),2); east++ )
-                 for( unsigned int south=0; south<=min(neighbors[2].get_num_paths(),2); south++ )
-                     for( unsigned int west=0; west<=min(neighbors[3].get_num_paths(),2); west++ )
-                         if( north+east+south+west == num_bridges ) {
-                             std::cout << "    Stepwise solution: " << north << ", "
-                             << east << ", "
-                             << south << ", " << west << "\n";
-                             std::vector<Edge> solution;
-                             for( unsigned int i=0; i<north; i++ ) {
-                                 Edge e(node, neighbors[0]);
-                                 solution.push_back( e );
-                             }
-                             for( unsigned int i=0; i<east; i++ ){
-                                 Edge e(node, neighbors[1]);
-                                 solution.push_back( e );
-                             }
-                             for( unsigned int i=0; i<south; i++ ){
-                                 Edge e(node, neighbors[2]);
-                                 solution.push_back( e );
-                             }
-                             for( unsigned int i=0; i<west; i++ ){
-                                 Edge e(node, neighbors[3]);
-                                 solution.push_back( e );
-                             }
-                             solutions.push_back( solution );
-                         }
-         if(solutions.empty())
-             std::cout << "    NO Stepwise solution: neighbors=4, bridges=" << num_bridges << "\n";
-     } else {
-         std::cout << "    NO Stepwise solution: neighbors=" << neighbors.size() << " bridges="
-                     << num_bridges << "\n";
-     }
+    // so each neighbor gets 0 or 1 or 2 but no more than it can take?
+    // count[] runs through them all like an odometer, the last neighbor fastest.
+    unsigned int count[4] = { 0, 0, 0, 0 };
+    while( k > 0 ) {
+        unsigned int sum = 0;
+        for( unsigned int n=0; n<k; n++ )
+            sum += count[n];
+        if( sum == num_bridges ) {
+            for( unsigned int n=0; n<k; n++ )
+                result.counts.push_back(count[n]);
+            if( trace ) {
+                *state.out << "    Stepwise solution: ";
+                for( unsigned int n=0; n<k; n++ )
+                    *state.out << (n > 0 ? ", " : "") << count[n];
+                *state.out << "\n";
+            }
+        }
+        int n = k - 1;
+        while( n >= 0 && count[n] == result.caps[n] )
+            count[n--] = 0;
+        if( n < 0 )
+            break;
+        count[n]++;
+    }
+    if( result.size() == 0 && verbosity >= HashiOptions::EVENTS )
+        *state.out << "    NO Stepwise solution: neighbors=" << k << ", bridges=" << num_bridges << "\n";
+}
 
-    return solutions;
+// Find the islands that island can still build bridges to: its adjacent ones, since
+// a bridge may not pass over any island, including those that already have all
+// their bridges. Islands that need no more bridges are left out, and so are bridges
+// that would cross the solution so far and neighbors that already have a double
+// bridge with island. The neighbors are in the order of the islands, which is the
+// order the stepwise solutions come in.
+void Graph::neighbors(const SearchState &state, unsigned int island, Stepwise &result) const {
+    std::vector<unsigned int> &nbrs = result.nbrs;
+    std::vector<unsigned int> &edges = result.edges;
+    std::vector<unsigned int> &caps = result.caps;
+    nbrs.clear();
+    edges.clear();
+    caps.clear();
+    for(unsigned int d=0; d<4; d++) {
+        unsigned int i = adjacent[4*island + d];
+        if(i == NO_ISLAND || state.demand[i] == 0)
+            continue;
+        unsigned int e = slot_edge[4*island + d];
+        unsigned int built = bridge_count(state, e);
+        if(built >= 2 || (built == 0 && crossed(state, e)))
+            continue;
+        unsigned int k = nbrs.size();
+        nbrs.push_back(i);
+        edges.push_back(e);
+        caps.push_back(min(state.demand[i], 2 - built));
+        for(; k > 0 && nbrs[k-1] > i; k--) {
+            std::swap(nbrs[k-1], nbrs[k]);
+            std::swap(edges[k-1], edges[k]);
+            std::swap(caps[k-1], caps[k]);
+        }
+    }
 }
 
-// Remove all edges in stepwise_solution from the graph
-void Graph::reduce(const std::vector<Edge> &stepwise_solution, const Node &node) {
-    for( unsigned int i = 0; i < stepwise_solution.size(); i++ ) {
-        const Edge &edge = stepwise_solution[i];
-        // find the other node, and reduce its num_paths.
-        // If num_paths reaches 0, remove the node.
-        const Point &other_point = edge.get_other(node.get_pt());
-        reduce_node(other_point);
+// Place the bridges that state forces, over and over until there are no more: when
+// an island needs more bridges than all its neighbors but one can take, the rest
+// must go to that one. This covers islands with a single neighbor, and islands that
+// need all their neighbors can take. Each placed bridge rules out the candidates
+// that would cross it, which can force more. Returns false if an island can no
+// longer get all its bridges. scratch holds the neighbors of one island at a time.
+bool Graph::propagate(SearchState &state, Stepwise &scratch) const {
+    bool changed = true;
+    while( changed ) {
+        changed = false;
+        for( unsigned int i=0; i<nodes.size(); i++ ) {
+            if( state.demand[i] == 0 )
+                continue;
+            neighbors(state, i, scratch);
+            unsigned int demand = state.demand[i];
+            unsigned int total = 0;
+            for( unsigned int k=0; k<scratch.caps.size(); k++ )
+                total += scratch.caps[k];
+            if( demand > total ) {
+                if( verbosity >= HashiOptions::EVENTS )
+                    *state.out << "  Propagate() Node " << Node(nodes[i].get_pt(), demand)
+                              << " can get only " << total << " bridges" << std::endl;
+                return false;
+            }
+            for( unsigned int k=0; k<scratch.nbrs.size(); k++ ) {
+                // what the other neighbors can take falls short of demand by forced
+                int forced = int(demand) - int(total - scratch.caps[k]);
+                for( int j=0; j<forced; j++ ) {
+                    place_bridge(state, scratch.edges[k], i);
+                    if( verbosity >= HashiOptions::TRACE )
+                        *state.out << "  Propagate() forced" << Edge(nodes[i], nodes[scratch.nbrs[k]])
+                                   << std::endl;
+                    changed = true;
+                }
+            }
+        }
     }
+    return true;
 }
 
-// Use p, find the node in this graph, and decrement its num_paths.
-// If num_paths reaches 0, remove the node.
-void Graph::reduce_node(const Point &p) {
-    for( unsigned int i=0; i<nodes.size(); i++) {
-        Node & node = nodes[i];
-        if(node.get_pt().equals(p)) {
-            if( node.reduce_num_paths() == 0 )
-                nodes.erase( nodes.begin() + i );
-            return;
+// Place a bridge on edge e, from island from
+void Graph::place_bridge(SearchState &state, unsigned int e, unsigned int from) const {
+    unsigned int a = edge_ends[e].first;
+    unsigned int b = edge_ends[e].second;
+    assert( state.demand[a] > 0 && state.demand[b] > 0 && bridge_count(state, e) < 2 );
+    assert( from == a || from == b );
+    state.bridges[e / 32] += uint64_t(1) << (2 * (e % 32));
+    state.solution.push_back(2*e + (from == b));
+    state.demand[a]--;
+    state.demand[b]--;
+    
+    // join the groups of a and b, the smaller one under the larger
+    unsigned int root = find_group(state, a);
+    unsigned int other = find_group(state, b);
+    if( root != other ) {
+        if( state.size[root] < state.size[other] )
+            std::swap(root, other);
+        state.group[other] = root;
+        state.size[root] += state.size[other];
+        state.open[root] += state.open[other];
+        state.merged.push_back(other);
+    }
+    else
+        state.merged.push_back(NO_ISLAND);
+    state.open[root] -= 2;
+    if( state.open[root] == 0 && state.size[root] < nodes.size() )
+        state.closed++;
+}
+
+// Take the bridges placed since the solution had mark bridges off again
+void Graph::undo(SearchState &state, unsigned int mark) const {
+    while( state.solution.size() > mark ) {
+        unsigned int e = state.solution.back() / 2;
+        unsigned int a = edge_ends[e].first;
+        unsigned int b = edge_ends[e].second;
+        // the groups are as place_bridge left them, as everything since is undone
+        unsigned int root = find_group(state, a);
+        if( state.open[root] == 0 && state.size[root] < nodes.size() )
+            state.closed--;
+        state.open[root] += 2;
+        unsigned int other = state.merged.back();
+        if( other != NO_ISLAND ) {
+            state.group[other] = other;
+            state.size[root] -= state.size[other];
+            state.open[root] -= state.open[other];
         }
+        state.merged.pop_back();
+        state.bridges[e / 32] -= uint64_t(1) << (2 * (e % 32));
+        state.demand[a]++;
+        state.demand[b]++;
+        state.solution.pop_back();
     }
-    assert(false);
 }
 
-// Test to see if bridge crosses any nodes in the graph
-bool Graph::bridge_crosses_nodes(const Edge &bridge) const {
-    for( unsigned int i=0; i<nodes.size(); i++ ) {
-        const Point &point = nodes[i].get_pt();
-        const Point &end1 = bridge.get_a();
-        const Point &end2 = bridge.get_b();
-        if( end1.get_x() == end2.get_x() && end2.get_x() == point.get_x()
-           && in_middle(point.get_y(), end1.get_y(), end2.get_y()) ){
-            //std::cout << "In_middle: " << point << " between " << end1 << " and " << end2 << "\n";
-            return true;
+// The root of the group of island
+unsigned int Graph::find_group(const SearchState &state, unsigned int island) const {
+    while( state.group[island] != island )
+        island = state.group[island];
+    return island;
+}
+
+// Fill adjacent[] by sweeping the board a row and a column at a time: each island
+// met is adjacent to the one met before it
+void Graph::find_adjacent() {
+    unsigned int width = max_x + 1, height = max_y + 1;
+    std::vector<unsigned int> grid(width * height, NO_ISLAND);
+    for( unsigned int i=0; i<nodes.size(); i++ )
+        grid[nodes[i].get_pt().get_x() + nodes[i].get_pt().get_y() * width] = i;
+    adjacent.assign(4 * nodes.size(), NO_ISLAND);
+    for( unsigned int y=0; y<height; y++ ) {
+        unsigned int last = NO_ISLAND;
+        for( unsigned int x=0; x<width; x++ ) {
+            unsigned int i = grid[x + y * width];
+            if( i == NO_ISLAND )
+                continue;
+            if( last != NO_ISLAND ) {
+                adjacent[4*last + 0] = i;
+                adjacent[4*i + 2] = last;
+            }
+            last = i;
         }
-        if( end1.get_y() == end2.get_y() && end2.get_y() == point.get_y()
-           && in_middle(point.get_x(), end1.get_x(), end2.get_x()) ){
-            //std::cout << "In_middle: " << point << " between " << end1 << " and " << end2 << "\n";
-            return true;
+    }
+    for( unsigned int x=0; x<width; x++ ) {
+        unsigned int last = NO_ISLAND;
+        for( unsigned int y=0; y<height; y++ ) {
+            unsigned int i = grid[x + y * width];
+            if( i == NO_ISLAND )
+                continue;
+            if( last != NO_ISLAND ) {
+                adjacent[4*last + 1] = i;
+                adjacent[4*i + 3] = last;
+            }
+            last = i;
+        }
+    }
+}
+
+// Number the candidate edges, and find the edges each one crosses: lay the
+// horizontal edges out on a grid of the board, then walk each vertical edge over it
+void Graph::find_crossings() {
+    slot_edge.assign(adjacent.size(), NO_ISLAND);
+    edge_ends.clear();
+    for( unsigned int i=0; i<nodes.size(); i++ )
+        for( unsigned int d=0; d<2; d++ ) {
+            unsigned int j = adjacent[4*i + d];
+            if( j == NO_ISLAND )
+                continue;
+            slot_edge[4*i + d] = slot_edge[4*j + (d ^ 2)] = edge_ends.size();
+            edge_ends.push_back(std::make_pair(i, j));
         }
+    
+    unsigned int width = max_x + 1;
+    std::vector<unsigned int> grid(width * (max_y + 1), NO_ISLAND);
+    for( unsigned int e=0; e<edge_ends.size(); e++ ) {
+        const Point &a = nodes[edge_ends[e].first].get_pt();
+        const Point &b = nodes[edge_ends[e].second].get_pt();
+        if( a.get_y() == b.get_y() )
+            for( int x = a.get_x() + 1; x < b.get_x(); x++ )
+                grid[x + a.get_y() * width] = e;
+    }
+    std::vector<std::vector<unsigned int> > crossed_by(edge_ends.size());
+    for( unsigned int e=0; e<edge_ends.size(); e++ ) {
+        const Point &a = nodes[edge_ends[e].first].get_pt();
+        const Point &b = nodes[edge_ends[e].second].get_pt();
+        if( a.get_x() != b.get_x() )
+            continue;
+        for( int y = a.get_y() + 1; y < b.get_y(); y++ ) {
+            unsigned int h = grid[a.get_x() + y * width];
+            if( h != NO_ISLAND ) {
+                crossed_by[e].push_back(h);
+                crossed_by[h].push_back(e);
+            }
+        }
+    }
+    
+    // and turn the lists into masks
+    crossings.clear();
+    cross_start.assign(1, 0);
+    for( unsigned int e=0; e<edge_ends.size(); e++ ) {
+        std::vector<unsigned int> &list = crossed_by[e];
+        std::sort(list.begin(), list.end());
+        for( unsigned int k=0; k<list.size(); k++ ) {
+            if( k == 0 || list[k] / 32 != crossings.back().word ) {
+                CrossMask mask = { list[k] / 32, 0 };
+                crossings.push_back(mask);
+            }
+            crossings.back().bits |= uint64_t(1) << (2 * (list[k] % 32));
+        }
+        cross_start.push_back(crossings.size());
+    }
+}
+
+// Test to see if a bridge on edge e would cross one placed already: each 2 bits of
+// state.bridges are 0 unless the edge has a bridge
+bool Graph::crossed(const SearchState &state, unsigned int e) const {
+    for( unsigned int k = cross_start[e]; k < cross_start[e+1]; k++ ) {
+        uint64_t word = state.bridges[crossings[k].word];
+        if( (word | word >> 1) & crossings[k].bits )
+            return true;
     }
     return false;
 }
 
+// A hash of what the search below state depends on: what the islands not done yet
+// need, what the edges between them can take, and with connected, which of them
+// the bridges so far join. Islands that are done are in a group with some that
+// aren't, else connected would have ruled the state out.
+uint64_t Graph::residual_key(SearchState &state, bool connected) const {
+    uint64_t key = 0;
+    const uint64_t *edge_keys = &zobrist[8 * nodes.size()];
+    for( unsigned int i = 0; i < nodes.size(); i++ ) {
+        if( state.demand[i] == 0 )
+            continue;
+        key ^= zobrist[8*i + state.demand[i] - 1];
+        // the edges going right and down are the ones i is the first island of
+        for( unsigned int d = 0; d < 2; d++ ) {
+            unsigned int j = adjacent[4*i + d];
+            if( j == NO_ISLAND || state.demand[j] == 0 )
+                continue;
+            unsigned int e = slot_edge[4*i + d];
+            unsigned int built = bridge_count(state, e);
+            if( built < 2 && !(built == 0 && crossed(state, e)) )
+                key ^= edge_keys[2*e + 1 - built];
+        }
+    }
+    if( connected ) {
+        // each island in a group goes with the first island of it
+        std::vector<unsigned int> &first = state.first_in_group;
+        for( unsigned int i = 0; i < nodes.size(); i++ )
+            first[i] = NO_ISLAND;
+        for( unsigned int i = 0; i < nodes.size(); i++ ) {
+            if( state.demand[i] == 0 )
+                continue;
+            unsigned int root = find_group(state, i);
+            if( first[root] == NO_ISLAND )
+                first[root] = i;
+            else
+                key ^= mix(uint64_t(i) << 32 | first[root]);
+        }
+    }
+    return key;
+}
+
+// The bridges placed so far, each from the island it was placed from
+std::vector<Edge> Graph::solution_edges(const SearchState &state) const {
+    std::vector<Edge> solution;
+    for( unsigned int i=0; i<state.solution.size(); i++ ) {
+        const std::pair<unsigned int, unsigned int> &ends = edge_ends[state.solution[i] / 2];
+        if( state.solution[i] % 2 == 0 )
+            solution.push_back(Edge(nodes[ends.first], nodes[ends.second]));
+        else
+            solution.push_back(Edge(nodes[ends.second], nodes[ends.first]));
+    }
+    return solution;
+}
+
+// The islands that still need bridges, each with how many it needs
+std::vector<Node> Graph::remaining_nodes(const SearchState &state) const {
+    std::vector<Node> remaining;
+    for( unsigned int i=0; i<nodes.size(); i++ )
+        if( state.demand[i] > 0 )
+            remaining.push_back(Node(nodes[i].get_pt(), state.demand[i]));
+    return remaining;
+}
+
 // min(x, y)
 unsigned int min( unsigned int x, unsigned int y) {
     return (x > y) ? y : x;
@@ -272,6 +633,13 @@ bool in_middle( unsigned int x, unsigned int end1, unsigned int end2 ) {
         return end1 > x && x > end2;
 }
 
+// Scramble the bits of x, as the last step of splitmix64 does
+uint64_t mix( uint64_t x ) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
 // Check to see if this bridge crosses that
 bool Edge::crosses(const Edge &that) const {
     if( this->vertical() && that.horizontal() ) {
@@ -293,32 +661,6 @@ bool Edge::crosses(const Edge &that) const {
     return false;
 }
 
-// Add indexes to nodes reachable from Node #tried_index to reached_nodes
-void Graph::reach_nodes(std::vector<Node> &reached_nodes, unsigned int tried_index) const {
-    const Node &node = reached_nodes[tried_index];
-    for( unsigned int i=0; i<nodes.size(); i++ ){
-        const Node &g_node = nodes[i];
-        if( !node.equals(g_node) && node.is_neighbor(g_node) && !g_node.included(reached_nodes)) {
-            Edge e(node, g_node);
-            if( e.included(edges) ) {
-                reached_nodes.push_back(g_node);
-            }
-        }
-    }
-}
-
-// Check to see if this graph is connected
-bool Graph::connected() const {
-    unsigned int size = nodes.size();
-    assert( size > 1 );
-    std::vector<Node> reached_nodes;
-    reached_nodes.push_back(nodes[0]);
-    for( unsigned int tried_index=0; tried_index<reached_nodes.size(); tried_index++ ){
-        reach_nodes(reached_nodes, tried_index);
-    }
-    return reached_nodes.size() == nodes.size();
-}
-
 bool included(const Point &p, const std::vector<Node> &nodes_) {
     for( unsigned int i=0; i<nodes_.size(); i++ )
         if( p.equals(nodes_[i].get_pt()) )
@@ -326,10 +668,12 @@ bool included(const Point &p, const std::vector<Node> &nodes_) {
     return false;
 }
 
-void Graph::printPartialGraph(const std::vector<Edge> &partial_solution, const Graph &remaining_graph) {
+void Graph::printPartialGraph(const std::vector<Edge> &partial_solution,
+                              const std::vector<Node> &remaining_nodes,
+                              std::ostream &ostr) const {
     Graph g;
-    for(unsigned int i=0; i<remaining_graph.nodes.size(); i++)
-        g.addNode(remaining_graph.nodes[i].get_pt(), remaining_graph.nodes[i].get_num_paths());
+    for(unsigned int i=0; i<remaining_nodes.size(); i++)
+        g.addNode(remaining_nodes[i].get_pt(), remaining_nodes[i].get_num_paths());
     for(unsigned int i=0; i<partial_solution.size(); i++){
         const Point &a = partial_solution[i].get_a();
         const Point &b = partial_solution[i].get_b();
@@ -339,6 +683,6 @@ void Graph::printPartialGraph(const std::vector<Edge> &partial_solution, const G
             g.addNode(b, 0);
         g.addEdge(a, b);
     }
-    g.printGraph();
+    g.printGraph(ostr);
 }
 
@@ -0,0 +1,247 @@
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "graph.h"
+
+// Searching in parallel. The search tree is cut into Tasks, each a subtree searched
+// by one thread on its own. A Task is known by its path, the stepwise solution taken
+// at each depth on the way to it, and paths in order are Tasks in the order a search
+// on one thread comes to them. Each thread keeps its Tasks in a deque: it takes the
+// newest for itself, and a thread with none left steals the oldest of another. A
+// thread searching a Task that sees another thread idle hands out the stepwise
+// solutions it hasn't tried yet at the node it is at, as Tasks of their own.
+//
+// What a Task prints is kept until every Task before it is printed, so the output
+// is that of the search on one thread however the threads are scheduled.
+
+typedef std::vector<unsigned int> Path;
+
+// A subtree of the search, and what its search printed
+struct Graph::Task {
+    Path path;
+    std::vector<unsigned int> bridges;  // placed on the way to it, as in SearchState::solution
+    std::vector<std::string> pieces;    // output, cut where each solution starts
+    unsigned long solutions;
+};
+
+// A thread of the search
+struct Graph::Worker {
+    TaskPool *pool;
+    SearchState state;
+    Task *task;                 // being searched
+    std::ostringstream out;     // what task printed since the last solution
+    std::deque<Task*> tasks;    // to search, the newest at the back
+    std::mutex lock;            // of tasks
+    // branches whose Tasks were handed out below them, and the solutions found on
+    // this thread below them
+    std::vector<std::pair<Path, unsigned long> > deferred;
+};
+
+struct Graph::TaskPool {
+    Worker *workers;
+    unsigned int num_workers;
+    std::atomic<unsigned int> idle;         // threads looking for a Task
+    std::atomic<unsigned long> outstanding; // Tasks handed out and not done yet
+    std::mutex lock;                        // of the rest
+    std::set<Path> active;                  // Tasks handed out and not done yet
+    std::map<Path, Task*> done;             // Tasks done and not printed yet
+    std::vector<std::pair<Path, unsigned long> > found;    // solutions of each Task done
+    unsigned long printed;                  // solutions printed so far
+};
+
+void Graph::hashi_parallel(const HashiOptions &options, unsigned int num_threads) {
+    std::vector<Worker> workers(num_threads);
+    TaskPool pool;
+    for( unsigned int w = 0; w < num_threads; w++ )
+        workers[w].pool = &pool;
+    pool.workers = &workers[0];
+    pool.num_workers = num_threads;
+    pool.idle = 0;
+    pool.outstanding = 1;
+    pool.printed = 0;
+
+    // the first Task is the whole search
+    Task *root = new Task;
+    root->solutions = 0;
+    pool.active.insert(root->path);
+    workers[0].tasks.push_back(root);
+
+    std::vector<std::thread> threads;
+    for( unsigned int w = 1; w < num_threads; w++ )
+        threads.push_back(std::thread(&Graph::work, this, std::ref(pool), w, std::cref(options)));
+    work(pool, 0, options);
+    for( unsigned int w = 0; w < threads.size(); w++ )
+        threads[w].join();
+    assert( pool.active.empty() && pool.done.empty() );
+
+    stats = HashiStats();
+    for( unsigned int w = 0; w < num_threads; w++ ) {
+        const HashiStats &s = workers[w].state.stats;
+        stats.nodes += s.nodes;
+        stats.dead_ends += s.dead_ends;
+        stats.branches += s.branches;
+        stats.backtracks += s.backtracks;
+        stats.max_depth = std::max(stats.max_depth, s.max_depth);
+        stats.solutions += s.solutions;
+        stats.table_hits += s.table_hits;
+        stats.timed_out = stats.timed_out || workers[w].state.stopped;
+        if( s.solutions > 0 )
+            edges = workers[w].state.last_solution;
+    }
+    // A deferred branch found no solution if no Task below it did. Those are the
+    // Tasks whose paths start with its own, all together in path order.
+    std::sort(pool.found.begin(), pool.found.end());
+    for( unsigned int w = 0; w < num_threads; w++ ) {
+        for( unsigned int i = 0; i < workers[w].deferred.size(); i++ ) {
+            const Path &branch = workers[w].deferred[i].first;
+            unsigned long solutions = workers[w].deferred[i].second;
+            std::vector<std::pair<Path, unsigned long> >::const_iterator task =
+                std::lower_bound(pool.found.begin(), pool.found.end(), std::make_pair(branch, 0ul));
+            for( ; task != pool.found.end() && task->first.size() >= branch.size()
+                   && std::equal(branch.begin(), branch.end(), task->first.begin()); ++task )
+                solutions += task->second;
+            if( solutions == 0 )
+                stats.backtracks++;
+        }
+    }
+}
+
+// Search Tasks on thread w until there are none left anywhere
+void Graph::work(TaskPool &pool, unsigned int w, const HashiOptions &options) const {
+    Worker &me = pool.workers[w];
+    start_search(me.state);
+    me.state.out = &me.out;
+    me.state.worker = &me;
+
+    bool idle = false;
+    while( true ) {
+        Task *task = take(pool, w);
+        if( task == NULL ) {
+            if( !idle ) {
+                pool.idle++;
+                idle = true;
+            }
+            if( pool.outstanding == 0 )
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        if( idle ) {
+            pool.idle--;
+            idle = false;
+        }
+
+        // get to the Task's subtree, search it, and get back
+        me.task = task;
+        for( unsigned int i = 0; i < task->bridges.size(); i++ ) {
+            unsigned int e = task->bridges[i] / 2;
+            place_bridge(me.state, e, task->bridges[i] % 2 ? edge_ends[e].second : edge_ends[e].first);
+        }
+        me.state.path = task->path;
+        unsigned long solutions = me.state.stats.solutions;
+        hashi_r(me.state, options, task->path.size());
+        undo(me.state, 0);
+        task->solutions = me.state.stats.solutions - solutions;
+        task->pieces.push_back(me.out.str());
+        me.out.str("");
+        finish(pool, task);
+        pool.outstanding--;
+    }
+    if( idle )
+        pool.idle--;
+}
+
+// Take a Task for thread w: its own newest, or else the oldest of another thread
+Graph::Task* Graph::take(TaskPool &pool, unsigned int w) const {
+    for( unsigned int i = 0; i < pool.num_workers; i++ ) {
+        Worker &from = pool.workers[(w + i) % pool.num_workers];
+        std::lock_guard<std::mutex> guard(from.lock);
+        if( from.tasks.empty() )
+            continue;
+        Task *task;
+        if( i == 0 ) {
+            task = from.tasks.back();
+            from.tasks.pop_back();
+        }
+        else {
+            task = from.tasks.front();
+            from.tasks.pop_front();
+        }
+        return task;
+    }
+    return NULL;
+}
+
+// Print task once it and every Task before it is done, with those after it that
+// were waiting for it. Any Task handed out later has the path of an active one
+// with more on the end, so comes after the first active Task.
+void Graph::finish(TaskPool &pool, Task *task) const {
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.active.erase(task->path);
+    pool.done[task->path] = task;
+    pool.found.push_back(std::make_pair(task->path, task->solutions));
+    while( !pool.done.empty()
+          && (pool.active.empty() || pool.done.begin()->first < *pool.active.begin()) ) {
+        Task *next = pool.done.begin()->second;
+        *out << next->pieces[0];
+        for( unsigned int i = 1; i < next->pieces.size(); i++ )
+            *out << "SOLUTION " << ++pool.printed << "===========" << std::endl
+                 << next->pieces[i];
+        out->flush();
+        pool.done.erase(pool.done.begin());
+        delete next;
+    }
+}
+
+// Is it worth handing out Tasks: some thread has none, and this one none waiting
+bool Graph::workers_idle(const SearchState &state) const {
+    Worker &me = *state.worker;
+    if( me.pool->idle == 0 )
+        return false;
+    std::lock_guard<std::mutex> guard(me.lock);
+    return me.tasks.empty();
+}
+
+// Hand out stepwise solution s of island, at the node state is at, as a Task
+void Graph::spawn(SearchState &state, unsigned int island, const Stepwise &choices,
+                  unsigned int s) const {
+    Worker &me = *state.worker;
+    unsigned int mark = state.solution.size();
+    place_stepwise(state, island, choices, s);
+    state.stats.branches++;
+    Task *task = new Task;
+    task->path = state.path;
+    task->path.push_back(s);
+    task->bridges = state.solution;
+    task->solutions = 0;
+    undo(state, mark);
+    state.spawned++;
+    me.deferred.push_back(std::make_pair(task->path, 0ul));
+    me.pool->outstanding++;
+    {
+        std::lock_guard<std::mutex> guard(me.pool->lock);
+        me.pool->active.insert(task->path);
+    }
+    std::lock_guard<std::mutex> guard(me.lock);
+    me.tasks.push_back(task);
+}
+
+// A solution starts here in the output of the Task being searched
+void Graph::start_solution(SearchState &state) const {
+    Worker &me = *state.worker;
+    me.task->pieces.push_back(me.out.str());
+    me.out.str("");
+}
+
+// The branch state is at handed out Tasks below it, after finding solutions itself
+void Graph::defer(SearchState &state, unsigned long solutions) const {
+    state.worker->deferred.push_back(std::make_pair(state.path, solutions));
+}
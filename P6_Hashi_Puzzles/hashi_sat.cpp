@@ -0,0 +1,167 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include "graph.h"
+#include "sat_solver.h"
+
+// Solving with the SAT solver in sat_solver.h. Candidate edge e has two variables:
+// 2*e, that it has a bridge, and 2*e+1, that it has two. The clauses are
+//   - an edge with two bridges has one:  not two(e) or one(e)
+//   - edges that cross don't both have bridges:  not one(e) or not one(f)
+//   - for each island, each way of putting 0, 1 or 2 bridges on its edges that
+//     doesn't add up to what it needs is ruled out by a clause of its own. An island
+//     has at most 4 edges, so at most 81 ways.
+// That the bridges join all the islands can't be put as clauses of the same size, so
+// with options.connected it is checked on each solution the solver finds: if the
+// bridges leave the islands in several groups, each group gets a cut, a clause that
+// some edge out of it has a bridge, and the solver goes on. Every connected solution
+// satisfies the cuts, so none is lost. With options.find_all_solutions each solution
+// found is ruled out in turn, until there are none left.
+
+// Add to clause the literals that are all false when edge e has count bridges, so
+// that clause rules that count out
+static void rule_out(unsigned int e, unsigned int count, std::vector<int> &clause) {
+    int one = 2*e, two = 2*e + 1;
+    if( count == 0 )
+        clause.push_back(SatSolver::pos(one));
+    else if( count == 1 ) {
+        clause.push_back(SatSolver::neg(one));
+        clause.push_back(SatSolver::pos(two));
+    }
+    else
+        clause.push_back(SatSolver::neg(two));
+}
+
+static unsigned int find_root(std::vector<unsigned int> &parent, unsigned int i) {
+    while( parent[i] != i )
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+void Graph::hashi_sat(const HashiOptions &options) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    stats = HashiStats();
+    unsigned int num_edges = edge_ends.size();
+    SatSolver solver;
+    for( unsigned int v = 0; v < 2 * num_edges; v++ )
+        solver.newVar();
+
+    std::vector<int> clause;
+    for( unsigned int e = 0; e < num_edges; e++ ) {
+        clause.clear();
+        clause.push_back(SatSolver::neg(2*e + 1));
+        clause.push_back(SatSolver::pos(2*e));
+        solver.addClause(clause);
+        for( unsigned int c = cross_start[e]; c < cross_start[e+1]; c++ )
+            for( uint64_t bits = crossings[c].bits; bits != 0; bits &= bits - 1 ) {
+                unsigned int f = 32 * crossings[c].word + __builtin_ctzll(bits) / 2;
+                if( f < e )
+                    continue;
+                clause.clear();
+                clause.push_back(SatSolver::neg(2*e));
+                clause.push_back(SatSolver::neg(2*f));
+                solver.addClause(clause);
+            }
+    }
+    for( unsigned int i = 0; i < nodes.size(); i++ ) {
+        std::vector<unsigned int> island_edges;
+        for( unsigned int d = 0; d < 4; d++ )
+            if( adjacent[4*i + d] != NO_ISLAND )
+                island_edges.push_back(slot_edge[4*i + d]);
+        unsigned int k = island_edges.size();
+        unsigned int ways = 1;
+        for( unsigned int n = 0; n < k; n++ )
+            ways *= 3;
+        for( unsigned int w = 0; w < ways; w++ ) {
+            clause.clear();
+            int sum = 0;
+            for( unsigned int n = 0, rest = w; n < k; n++, rest /= 3 ) {
+                sum += rest % 3;
+                rule_out(island_edges[n], rest % 3, clause);
+            }
+            if( sum != nodes[i].get_num_paths() )
+                solver.addClause(clause);
+        }
+    }
+
+    unsigned long cuts = 0;
+    std::vector<unsigned int> count(num_edges);
+    std::vector<unsigned int> parent(nodes.size());
+    while( true ) {
+        SatSolver::Result result = options.time_limit > 0 ? solver.solve(deadline) : solver.solve();
+        if( result == SatSolver::INTERRUPTED ) {
+            if( verbosity >= HashiOptions::EVENTS )
+                *out << "    Out of time." << std::endl;
+            stats.timed_out = true;
+            break;
+        }
+        if( result == SatSolver::UNSATISFIABLE )
+            break;
+        for( unsigned int e = 0; e < num_edges; e++ )
+            count[e] = solver.model(2*e) + solver.model(2*e + 1);
+
+        if( options.connected ) {
+            for( unsigned int i = 0; i < nodes.size(); i++ )
+                parent[i] = i;
+            unsigned int groups = nodes.size();
+            for( unsigned int e = 0; e < num_edges; e++ ) {
+                unsigned int a = find_root(parent, edge_ends[e].first);
+                unsigned int b = find_root(parent, edge_ends[e].second);
+                if( count[e] > 0 && a != b ) {
+                    parent[a] = b;
+                    groups--;
+                }
+            }
+            if( groups > 1 ) {
+                if( verbosity >= HashiOptions::EVENTS )
+                    *out << "    The bridges leave " << groups
+                         << " groups of islands, each gets a cut." << std::endl;
+                // the cut of each group is its edges to the others, by its root
+                std::vector<std::vector<int> > cut(nodes.size());
+                for( unsigned int e = 0; e < num_edges; e++ ) {
+                    unsigned int a = find_root(parent, edge_ends[e].first);
+                    unsigned int b = find_root(parent, edge_ends[e].second);
+                    if( a != b ) {
+                        cut[a].push_back(SatSolver::pos(2*e));
+                        cut[b].push_back(SatSolver::pos(2*e));
+                    }
+                }
+                for( unsigned int i = 0; i < nodes.size(); i++ )
+                    if( parent[i] == i ) {
+                        solver.addClause(cut[i]);
+                        cuts++;
+                    }
+                continue;
+            }
+        }
+
+        ++stats.solutions;
+        edges.clear();
+        for( unsigned int e = 0; e < num_edges; e++ )
+            for( unsigned int j = 0; j < count[e]; j++ )
+                edges.push_back(Edge(nodes[edge_ends[e].first], nodes[edge_ends[e].second]));
+        if( options.print_solutions ) {
+            *out << "SOLUTION " << stats.solutions << "===========" << std::endl;
+            printBridges(edges, *out);
+            printBoard(edges, *out);
+        }
+        if( solution_limit > 0 && stats.solutions >= solution_limit )
+            break;
+        clause.clear();
+        for( unsigned int e = 0; e < num_edges; e++ )
+            rule_out(e, count[e], clause);
+        solver.addClause(clause);
+    }
+
+    // in the terms of the recursive search: each decision is a node that branches,
+    // and each conflict a dead end that is backtracked out of
+    stats.nodes = stats.branches = solver.decisions;
+    stats.dead_ends = stats.backtracks = solver.conflicts;
+    stats.max_depth = solver.max_level;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    *out << "STATISTICS: " << stats << std::endl;
+    if( verbosity >= HashiOptions::EVENTS )
+        *out << "SAT STATISTICS: " << solver.propagations << " propagations, " << solver.conflicts
+             << " conflicts, " << solver.learnts << " learnt clauses, " << solver.restarts
+             << " restarts, " << cuts << " cuts" << std::endl;
+}
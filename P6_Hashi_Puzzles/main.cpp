@@ -4,6 +4,7 @@
 #include <iostream>
 
 #include "graph.h"
+#include "batch.h"
 
 
 int main(int argc, char* argv[] ) {
@@ -13,18 +14,54 @@ int main(int argc, char* argv[] ) {
         std::cout << "ERROR!  Must specify input file" << std::endl;
         exit(1);
     }
-    std::ifstream istr(argv[1]);
-    if (!istr.good()) {
-        std::cout << "ERROR!  Could not open input file '" << argv[1] << "'" << std::endl;
-        exit(1);
+    // "-" reads the input from standard input
+    std::ifstream file;
+    if (argv[1] != std::string("-")) {
+        file.open(argv[1]);
+        if (!file.good()) {
+            std::cout << "ERROR!  Could not open input file '" << argv[1] << "'" << std::endl;
+            exit(1);
+        }
     }
-    bool find_all_solutions = false;
-    bool connected = false;
+    std::istream &istr = file.is_open() ? file : std::cin;
+    HashiOptions options;
+    bool benchmark = false;
+    bool batch = false, batch_list = false;
     for (int i = 2; i < argc; i++) {
         if (argv[i] == std::string("--find_all_solutions")) {
-            find_all_solutions = true;
+            options.find_all_solutions = true;
         } else if (argv[i] == std::string("--connected")) {
-            connected = true;
+            options.connected = true;
+        } else if (argv[i] == std::string("--most_constrained")) {
+            options.most_constrained = true;
+        } else if (argv[i] == std::string("--quiet")) {
+            options.verbosity = HashiOptions::QUIET;
+        } else if (argv[i] == std::string("--verbosity") && i+1 < argc) {
+            options.verbosity = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--threads") && i+1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--engine") && i+1 < argc) {
+            std::string engine = argv[++i];
+            if (engine == "search") {
+                options.engine = HashiOptions::SEARCH;
+            } else if (engine == "sat") {
+                options.engine = HashiOptions::SAT;
+            } else {
+                std::cout << "ERROR!  Unknown engine '" << engine << "'" << std::endl;
+                exit(1);
+            }
+        } else if (argv[i] == std::string("--time_limit") && i+1 < argc) {
+            options.time_limit = atof(argv[++i]);
+        } else if (argv[i] == std::string("--count_only")) {
+            options.print_solutions = false;
+        } else if (argv[i] == std::string("--table_mb") && i+1 < argc) {
+            options.table_mb = atoi(argv[++i]);
+        } else if (argv[i] == std::string("--benchmark")) {
+            benchmark = true;
+        } else if (argv[i] == std::string("--batch")) {
+            batch = true;
+        } else if (argv[i] == std::string("--batch_list")) {
+            batch_list = true;
         } else {
             std::cout << "ERROR!  Unknown argument '" << argv[i] << "'" << std::endl;
             exit(1);
@@ -32,6 +69,12 @@ int main(int argc, char* argv[] ) {
     }
     
     
+    // The input file is many puzzles, or a list of puzzle files, see batch.h
+    if (batch || batch_list) {
+        solve_batch(istr, batch_list, options, std::cout);
+        return 0;
+    }
+    
     // Create an empty graph object
     Graph g;
     // Read in the puzzle from the input file
@@ -42,6 +85,26 @@ int main(int argc, char* argv[] ) {
         g.addNode(Point(x,y),n);
     }
     
-    g.hashi(connected, find_all_solutions);
+    if (!benchmark) {
+        g.hashi(options);
+        return 0;
+    }
+    
+    // Run each engine on the puzzle, without printing the solutions, and compare
+    options.verbosity = HashiOptions::QUIET;
+    options.print_solutions = false;
+    if (options.time_limit == 0)
+        options.time_limit = 60;
+    const char* names[] = { "search", "sat" };
+    for (unsigned int engine = HashiOptions::SEARCH; engine <= HashiOptions::SAT; engine++) {
+        options.engine = engine;
+        g.hashi(options);
+        const HashiStats &stats = g.get_stats();
+        std::cout << "BENCHMARK " << names[engine] << ": " << stats.solutions << " solutions, "
+                  << stats.seconds << " seconds";
+        if (stats.timed_out)
+            std::cout << ", timed out after " << options.time_limit << " seconds";
+        std::cout << std::endl;
+    }
     
 }
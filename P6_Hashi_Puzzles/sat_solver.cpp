@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cassert>
+#include "sat_solver.h"
+
+const signed char SatSolver::TRUE;
+const signed char SatSolver::FALSE;
+const signed char SatSolver::UNDEF;
+
+// the i-th number of the Luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ...
+static unsigned long luby(unsigned long i) {
+    unsigned long size = 1, power = 1;
+    while( size < i + 1 ) {
+        size = 2 * size + 1;
+        power *= 2;
+    }
+    while( size - 1 != i ) {
+        size = (size - 1) / 2;
+        power /= 2;
+        i %= size;
+    }
+    return power;
+}
+
+SatSolver::SatSolver()
+    : decisions(0), propagations(0), conflicts(0), learnts(0), restarts(0), max_level(0),
+      ok(true), qhead(0), var_inc(1) {}
+
+int SatSolver::newVar() {
+    int v = assigns.size();
+    assigns.push_back(UNDEF);
+    level.push_back(0);
+    reason.push_back(-1);
+    activity.push_back(0);
+    polarity.push_back(1);      // try false first
+    seen.push_back(0);
+    heap_index.push_back(-1);
+    models.push_back(false);
+    watches.push_back(std::vector<int>());
+    watches.push_back(std::vector<int>());
+    heapInsert(v);
+    return v;
+}
+
+bool SatSolver::addClause(std::vector<int> lits) {
+    if( !ok )
+        return false;
+    cancelUntil(0);
+    // drop literals false for good and repeats; a clause true for good is left out
+    std::sort(lits.begin(), lits.end());
+    unsigned int j = 0;
+    for( unsigned int i = 0; i < lits.size(); i++ ) {
+        if( value(lits[i]) == TRUE || (i > 0 && lits[i] == (lits[i-1] ^ 1)) )
+            return true;
+        if( value(lits[i]) != FALSE && (j == 0 || lits[i] != lits[j-1]) )
+            lits[j++] = lits[i];
+    }
+    lits.resize(j);
+    if( lits.empty() )
+        return ok = false;
+    if( lits.size() == 1 ) {
+        enqueue(lits[0], -1);
+        return ok = (propagate() == -1);
+    }
+    clauses.push_back(lits);
+    attach(clauses.size() - 1);
+    return true;
+}
+
+void SatSolver::attach(int c) {
+    watches[clauses[c][0]].push_back(c);
+    watches[clauses[c][1]].push_back(c);
+}
+
+void SatSolver::enqueue(int lit, int from) {
+    int v = lit >> 1;
+    assigns[v] = !(lit & 1);
+    level[v] = decisionLevel();
+    reason[v] = from;
+    trail.push_back(lit);
+}
+
+// Propagate the literals on the trail. Returns the clause found false, or -1. A
+// clause watches its first two literals, and only needs looking at when one of them
+// turns false: then it finds another literal to watch, or else the other watched one
+// is implied, or it is false.
+int SatSolver::propagate() {
+    while( qhead < trail.size() ) {
+        int false_lit = trail[qhead++] ^ 1;
+        propagations++;
+        std::vector<int> &ws = watches[false_lit];
+        unsigned int i = 0, j = 0;
+        while( i < ws.size() ) {
+            int c = ws[i++];
+            std::vector<int> &lits = clauses[c];
+            if( lits[0] == false_lit )
+                std::swap(lits[0], lits[1]);
+            if( value(lits[0]) == TRUE ) {
+                ws[j++] = c;
+                continue;
+            }
+            bool moved = false;
+            for( unsigned int k = 2; k < lits.size(); k++ )
+                if( value(lits[k]) != FALSE ) {
+                    std::swap(lits[1], lits[k]);
+                    watches[lits[1]].push_back(c);
+                    moved = true;
+                    break;
+                }
+            if( moved )
+                continue;
+            ws[j++] = c;
+            if( value(lits[0]) == FALSE ) {
+                while( i < ws.size() )
+                    ws[j++] = ws[i++];
+                ws.resize(j);
+                qhead = trail.size();
+                return c;
+            }
+            enqueue(lits[0], c);
+        }
+        ws.resize(j);
+    }
+    return -1;
+}
+
+// Learn a clause from conflict clause confl: resolve it with the reasons of its
+// literals from the current decision level, latest first, until only one is left.
+// learnt[0] is that one, the literal the clause implies after backjumping to
+// backtrack_level, and learnt[1] is one from that level.
+void SatSolver::analyze(int confl, std::vector<int> &learnt, int &backtrack_level) {
+    learnt.assign(1, -1);
+    int paths = 0;
+    int p = -1;
+    int index = trail.size() - 1;
+    do {
+        const std::vector<int> &lits = clauses[confl];
+        for( unsigned int k = (p == -1 ? 0 : 1); k < lits.size(); k++ ) {
+            int v = lits[k] >> 1;
+            if( seen[v] || level[v] == 0 )
+                continue;
+            bumpVar(v);
+            seen[v] = 1;
+            if( level[v] >= decisionLevel() )
+                paths++;
+            else
+                learnt.push_back(lits[k]);
+        }
+        while( !seen[trail[index] >> 1] )
+            index--;
+        p = trail[index--];
+        confl = reason[p >> 1];
+        seen[p >> 1] = 0;
+        paths--;
+    } while( paths > 0 );
+    learnt[0] = p ^ 1;
+
+    backtrack_level = 0;
+    for( unsigned int k = 1; k < learnt.size(); k++ ) {
+        int v = learnt[k] >> 1;
+        seen[v] = 0;
+        if( level[v] > backtrack_level ) {
+            backtrack_level = level[v];
+            std::swap(learnt[1], learnt[k]);
+        }
+    }
+}
+
+void SatSolver::cancelUntil(int lvl) {
+    if( decisionLevel() <= lvl )
+        return;
+    for( int i = trail.size() - 1; i >= trail_lim[lvl]; i-- ) {
+        int v = trail[i] >> 1;
+        assigns[v] = UNDEF;
+        polarity[v] = trail[i] & 1;
+        if( heap_index[v] < 0 )
+            heapInsert(v);
+    }
+    trail.resize(trail_lim[lvl]);
+    trail_lim.resize(lvl);
+    qhead = trail.size();
+}
+
+// the most active unassigned variable, in the sign it had last; -1 when all are set
+int SatSolver::pickBranchLit() {
+    while( !heap.empty() ) {
+        int v = heapPop();
+        if( assigns[v] == UNDEF )
+            return 2*v + polarity[v];
+    }
+    return -1;
+}
+
+void SatSolver::bumpVar(int v) {
+    if( (activity[v] += var_inc) > 1e100 ) {
+        for( unsigned int w = 0; w < activity.size(); w++ )
+            activity[w] *= 1e-100;
+        var_inc *= 1e-100;
+    }
+    if( heap_index[v] >= 0 )
+        heapUp(heap_index[v]);
+}
+
+SatSolver::Result SatSolver::solve() {
+    return run(false, std::chrono::steady_clock::time_point());
+}
+
+SatSolver::Result SatSolver::solve(std::chrono::steady_clock::time_point deadline) {
+    return run(true, deadline);
+}
+
+// search, starting over after 100, 100, 200, 100, 100, 200, 400, ... conflicts
+SatSolver::Result SatSolver::run(bool has_deadline, std::chrono::steady_clock::time_point deadline) {
+    if( !ok )
+        return UNSATISFIABLE;
+    for( unsigned long r = 0; ; r++ ) {
+        bool restart = false;
+        Result result = search(100 * luby(r), has_deadline, deadline, restart);
+        if( !restart )
+            return result;
+        restarts++;
+    }
+}
+
+// Decide and propagate until every variable has a value, a conflict at level 0
+// shows there is none to be had, or max_conflicts conflicts call for a restart
+SatSolver::Result SatSolver::search(unsigned long max_conflicts, bool has_deadline,
+                                    std::chrono::steady_clock::time_point deadline,
+                                    bool &restart) {
+    unsigned long conflicts_here = 0;
+    std::vector<int> learnt;
+    while( true ) {
+        int confl = propagate();
+        if( confl != -1 ) {
+            conflicts++;
+            conflicts_here++;
+            if( decisionLevel() == 0 ) {
+                ok = false;
+                return UNSATISFIABLE;
+            }
+            int backtrack_level;
+            analyze(confl, learnt, backtrack_level);
+            cancelUntil(backtrack_level);
+            if( learnt.size() == 1 )
+                enqueue(learnt[0], -1);
+            else {
+                clauses.push_back(learnt);
+                attach(clauses.size() - 1);
+                enqueue(learnt[0], clauses.size() - 1);
+            }
+            learnts++;
+            var_inc /= 0.95;
+            continue;
+        }
+        if( has_deadline && (conflicts_here + decisions) % 256 == 0
+           && std::chrono::steady_clock::now() > deadline ) {
+            cancelUntil(0);
+            return INTERRUPTED;
+        }
+        if( conflicts_here >= max_conflicts ) {
+            cancelUntil(0);
+            restart = true;
+            return INTERRUPTED;
+        }
+        int next = pickBranchLit();
+        if( next == -1 ) {
+            for( unsigned int v = 0; v < assigns.size(); v++ )
+                models[v] = assigns[v] == TRUE;
+            cancelUntil(0);
+            return SATISFIABLE;
+        }
+        decisions++;
+        trail_lim.push_back(trail.size());
+        if( decisionLevel() > int(max_level) )
+            max_level = decisionLevel();
+        enqueue(next, -1);
+    }
+}
+
+void SatSolver::heapInsert(int v) {
+    heap_index[v] = heap.size();
+    heap.push_back(v);
+    heapUp(heap.size() - 1);
+}
+
+int SatSolver::heapPop() {
+    int v = heap[0];
+    heap[0] = heap.back();
+    heap_index[heap[0]] = 0;
+    heap.pop_back();
+    heap_index[v] = -1;
+    if( !heap.empty() )
+        heapDown(0);
+    return v;
+}
+
+void SatSolver::heapUp(int i) {
+    int v = heap[i];
+    while( i > 0 && before(v, heap[(i - 1) / 2]) ) {
+        heap[i] = heap[(i - 1) / 2];
+        heap_index[heap[i]] = i;
+        i = (i - 1) / 2;
+    }
+    heap[i] = v;
+    heap_index[v] = i;
+}
+
+void SatSolver::heapDown(int i) {
+    int v = heap[i];
+    while( true ) {
+        unsigned int child = 2 * i + 1;
+        if( child >= heap.size() )
+            break;
+        if( child + 1 < heap.size() && before(heap[child + 1], heap[child]) )
+            child++;
+        if( !before(heap[child], v) )
+            break;
+        heap[i] = heap[child];
+        heap_index[heap[i]] = i;
+        i = child;
+    }
+    heap[i] = v;
+    heap_index[v] = i;
+}
@@ -0,0 +1,87 @@
+#ifndef sat_solver_h
+#define sat_solver_h
+
+#include <vector>
+#include <chrono>
+
+// ====================================================================================
+// A small CDCL SAT solver: unit propagation with two watched literals, conflict
+// analysis to the first unique implication point with the learnt clause kept and a
+// backjump to where it becomes unit, VSIDS branching with saved phases, and restarts
+// after Luby numbers of conflicts. Learnt clauses are never thrown away, which is
+// fine for the few thousand conflicts a Hashi puzzle takes.
+//
+// Clauses can be added between calls of solve(), which keeps what it learnt: every
+// learnt clause follows from the clauses so far, so it still holds when there are
+// more.
+
+class SatSolver {
+public:
+    // variables are 0, 1, 2, ...; literal 2*v is v, 2*v+1 is not v
+    static int pos(int v) { return 2*v; }
+    static int neg(int v) { return 2*v + 1; }
+    enum Result { UNSATISFIABLE, SATISFIABLE, INTERRUPTED };
+
+    SatSolver();
+    int newVar();
+    int numVars() const { return assigns.size(); }
+    // false once the clauses can no longer all be satisfied
+    bool addClause(std::vector<int> lits);
+    // with a deadline, gives up with INTERRUPTED once it has passed
+    Result solve();
+    Result solve(std::chrono::steady_clock::time_point deadline);
+    // of the last SATISFIABLE solve()
+    bool model(int v) const { return models[v]; }
+
+    // counts since the solver was made
+    unsigned long decisions;
+    unsigned long propagations;
+    unsigned long conflicts;
+    unsigned long learnts;
+    unsigned long restarts;
+    unsigned int max_level;     // deepest decision level reached
+
+private:
+    static const signed char TRUE = 1, FALSE = 0, UNDEF = 2;
+    signed char value(int lit) const {
+        signed char a = assigns[lit >> 1];
+        return a == UNDEF ? UNDEF : a ^ (lit & 1);
+    }
+    int decisionLevel() const { return trail_lim.size(); }
+    void enqueue(int lit, int from);
+    int propagate();
+    void analyze(int confl, std::vector<int> &learnt, int &backtrack_level);
+    void cancelUntil(int level);
+    void attach(int c);
+    int pickBranchLit();
+    Result run(bool has_deadline, std::chrono::steady_clock::time_point deadline);
+    Result search(unsigned long max_conflicts, bool has_deadline,
+                  std::chrono::steady_clock::time_point deadline, bool &restart);
+    void bumpVar(int v);
+    // the heap of unassigned variables, most active first
+    bool before(int v, int w) const { return activity[v] > activity[w]; }
+    void heapInsert(int v);
+    int heapPop();
+    void heapUp(int i);
+    void heapDown(int i);
+
+    // REPRESENTATION
+    bool ok;                                    // false once unsatisfiable for good
+    std::vector<std::vector<int> > clauses;     // the watched literals come first
+    std::vector<std::vector<int> > watches;     // clauses watching each literal
+    std::vector<signed char> assigns;           // of each variable, or UNDEF
+    std::vector<int> level;                     // decision level it was assigned at
+    std::vector<int> reason;                    // clause that implied it, or -1
+    std::vector<int> trail;                     // assigned literals, in order
+    std::vector<int> trail_lim;                 // where each decision level starts
+    unsigned int qhead;                         // trail[qhead..] still to propagate
+    std::vector<double> activity;
+    double var_inc;
+    std::vector<char> polarity;                 // the sign each variable had last
+    std::vector<char> seen;                     // scratch for analyze()
+    std::vector<int> heap;
+    std::vector<int> heap_index;                // of each variable in heap, or -1
+    std::vector<bool> models;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include "transposition_table.h"
+
+const unsigned int TranspositionTable::SLOTS;
+
+void TranspositionTable::reset(size_t max_bytes) {
+    const size_t bucket_bytes = SLOTS * sizeof(Entry);
+    max_buckets = 0;
+    if( max_bytes >= bucket_bytes )
+        for( max_buckets = 1; 2 * max_buckets * bucket_bytes <= max_bytes; max_buckets *= 2 )
+            ;
+    Entry empty = { 0, 0, 0 };
+    entries.assign(SLOTS * std::min(max_buckets, size_t(1024)), empty);
+    used = 0;
+    hits = stores = replaced = 0;
+}
+
+bool TranspositionTable::find(uint64_t key, unsigned long &solutions) {
+    if( entries.empty() )
+        return false;
+    size_t bucket = key & (entries.size() / SLOTS - 1);
+    for( unsigned int s = 0; s < SLOTS; s++ ) {
+        const Entry &entry = entries[SLOTS * bucket + s];
+        if( entry.nodes > 0 && entry.key == key ) {
+            solutions = entry.solutions;
+            hits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, unsigned long solutions, unsigned long nodes) {
+    if( entries.empty() || solutions > UINT32_MAX )
+        return;
+    if( used * 4 >= entries.size() * 3 && entries.size() / SLOTS < max_buckets )
+        grow();
+    stores++;
+    size_t bucket = key & (entries.size() / SLOTS - 1);
+    Entry *slot = &entries[SLOTS * bucket];
+    for( unsigned int s = 0; s < SLOTS; s++ ) {
+        Entry &entry = entries[SLOTS * bucket + s];
+        if( entry.nodes == 0 || entry.key == key ) {
+            slot = &entry;
+            break;
+        }
+        if( entry.nodes < slot->nodes )
+            slot = &entry;
+    }
+    if( slot->nodes == 0 )
+        used++;
+    else if( slot->key != key )
+        replaced++;
+    slot->key = key;
+    slot->solutions = solutions;
+    slot->nodes = std::max(1ul, std::min(nodes, (unsigned long)UINT32_MAX));
+}
+
+// Double the buckets, and put each state in its bucket again
+void TranspositionTable::grow() {
+    std::vector<Entry> old;
+    old.swap(entries);
+    Entry empty = { 0, 0, 0 };
+    entries.assign(2 * old.size(), empty);
+    used = 0;
+    for( size_t i = 0; i < old.size(); i++ )
+        if( old[i].nodes > 0 ) {
+            size_t bucket = old[i].key & (entries.size() / SLOTS - 1);
+            unsigned int s = 0;
+            while( entries[SLOTS * bucket + s].nodes > 0 )
+                s++;
+            entries[SLOTS * bucket + s] = old[i];
+            used++;
+        }
+}
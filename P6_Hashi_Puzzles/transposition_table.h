@@ -0,0 +1,47 @@
+#ifndef transposition_table_h
+#define transposition_table_h
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+// ====================================================================================
+// A TranspositionTable remembers how many solutions the searches of states found,
+// by a 64-bit hash of each state. A state goes in one of the 4 slots of the bucket
+// its hash picks: its own slot if it's there already, else an empty one, else the
+// one whose search took the fewest nodes, being the cheapest to do over. The table
+// starts small and doubles as it fills, up to its budget of bytes, and from then on
+// only replaces.
+
+class TranspositionTable {
+public:
+    TranspositionTable() : hits(0), stores(0), replaced(0), max_buckets(0), used(0) {}
+    // forget everything, and take at most max_bytes from now on. 0 turns it off.
+    void reset(size_t max_bytes);
+    // the solutions below the state with hash key, if it is in the table
+    bool find(uint64_t key, unsigned long &solutions);
+    // that took nodes nodes to find
+    void store(uint64_t key, unsigned long solutions, unsigned long nodes);
+    size_t bytes() const { return entries.size() * sizeof(Entry); }
+
+    // counts since the last reset
+    unsigned long hits;
+    unsigned long stores;
+    unsigned long replaced;     // states pushed out by others
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t solutions;
+        uint32_t nodes;         // as many as fit, 0 in an empty slot
+    };
+    static const unsigned int SLOTS = 4;
+    void grow();
+
+    // REPRESENTATION
+    std::vector<Entry> entries;     // SLOTS of them to a bucket
+    size_t max_buckets;             // a power of 2, or 0 when off
+    size_t used;                    // slots
+};
+
+#endif